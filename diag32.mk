@@ -1,3 +1,3 @@
-project : C:\watcom\HDD_Diag\diag32.exe .SYMBOLIC
+project : C:\watcom\ATACMD\diag32.exe .SYMBOLIC
 
-!include C:\watcom\HDD_Diag\diag32.mk1
+!include C:\watcom\ATACMD\diag32.mk1
@@ -0,0 +1,3 @@
+// host build: the driver includes "ataio.h", the file is ATAIO.H
+
+#include "../src/ATAIO.H"
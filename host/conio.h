@@ -0,0 +1,3 @@
+// host build: <conio.h> is part of the <dos.h> shim
+
+#include <dos.h>
@@ -0,0 +1,76 @@
+//********************************************************************
+// ATA LOW LEVEL I/O DRIVER -- host/dos.h
+//
+// The <dos.h> of the host (Linux) build. The driver is written for
+// Open Watcom C, so this header gives gcc the Watcom names the
+// driver uses. The port I/O, interrupt and DOS memory functions
+// are stubs in hoststub.c, the register traffic goes to the
+// emulated device in ATAIOEMU.C.
+//
+// The driver assumes a 32-bit long (PRD entries, the 32-bit BMIDE
+// PRD address, linear addresses), so after the C library headers
+// are in, long is mapped to int. Every file of the host build
+// includes this header before it uses long.
+//
+// Far pointers are plain pointers. A seg:off pair holds a pointer
+// as seg = pointer >> 4 and off = pointer & 0xf, the same as the
+// normalized seg:off of the 16-bit build. A linear address is 32
+// bits, so data passed as seg:off has to be below 4GB: static data
+// of a program linked with -no-pie (not the stack, not the heap).
+//********************************************************************
+
+#ifndef HOST_DOS_H
+#define HOST_DOS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define long int
+
+#define far
+#define near
+#define interrupt
+
+#define MK_FP( seg, off )  ( (void *) ( ( ( (uintptr_t) ( seg ) ) << 4 ) + (uintptr_t) ( off ) ) )
+#define FP_SEG( p )        ( (unsigned int) ( ( (uintptr_t) ( p ) ) >> 4 ) )
+#define FP_OFF( p )        ( (unsigned int) ( ( (uintptr_t) ( p ) ) & 0x000f ) )
+
+#define _fmemcpy  memcpy
+#define _fmemset  memset
+#define _fmemcmp  memcmp
+
+// x86 registers for int86()
+
+struct WORDREGS { unsigned short ax, bx, cx, dx, si, di, cflag; };
+struct BYTEREGS { unsigned char al, ah, bl, bh, cl, ch, dl, dh; };
+union REGS { struct WORDREGS w; struct WORDREGS x; struct BYTEREGS h; };
+struct SREGS { unsigned short es, cs, ss, ds; };
+
+// stubs in hoststub.c
+
+extern unsigned int inp( unsigned int port );
+extern unsigned int inpw( unsigned int port );
+extern unsigned int outp( unsigned int port, unsigned int data );
+extern unsigned int outpw( unsigned int port, unsigned int data );
+
+extern void _enable( void );
+extern void _disable( void );
+
+extern int int86( int intNum, union REGS * in, union REGS * out );
+
+extern void ( * _dos_getvect( unsigned int intNum ) ) ();
+extern void _dos_setvect( unsigned int intNum, void ( * handler ) () );
+
+extern unsigned int _dos_allocmem( unsigned int paras, unsigned int * seg );
+extern unsigned int _dos_freemem( unsigned int seg );
+extern unsigned int _dos_setblock( unsigned int paras, unsigned int seg, unsigned int * maxParas );
+extern unsigned int _dos_commit( int handle );
+
+extern int kbhit( void );
+extern int getch( void );
+
+#endif
@@ -0,0 +1,275 @@
+//********************************************************************
+// ATA LOW LEVEL I/O DRIVER -- host/emutest.c
+//
+// Regression test and benchmark of the reg_* and dma_pci_*
+// functions against the emulated device of ATAIOEMU.C, see
+// host/Makefile ("make test").
+//
+// The test creates a sector image file in which every byte of a
+// sector is derived from its LBA, attaches it with emu_open() and
+// then checks IDENTIFY DEVICE, PIO data in/out (READ/WRITE
+// SECTORS EXT and READ MULTIPLE EXT) and PCI DMA (READ/WRITE DMA
+// EXT) against the image. At the end it times PIO and DMA reads.
+//
+// Usage: emutest [image file]
+//
+// Exit code 0 if all checks pass, 1 if not.
+//********************************************************************
+
+#include <dos.h>
+
+#include "ataio.h"
+
+#define TEST_SECTORS    4096L    // image size in sectors (2MB)
+#define TEST_BUF_SIZE   65536L   // I/O buffer size
+#define TEST_BENCH_MB   64L      // MB read by each benchmark
+
+// The I/O buffer is static, seg:off addresses it (host/dos.h).
+
+static unsigned char testBuf[ TEST_BUF_SIZE ];
+
+static int testErrors;
+
+//*************************************************************
+//
+// test_fill() - the test pattern of a sector.
+//
+//*************************************************************
+
+static void test_fill( unsigned char * buf, unsigned long lba, int salt )
+
+{
+   int ndx;
+
+   for ( ndx = 0; ndx < 512; ndx ++ )
+      buf[ndx] = (unsigned char) ( ( lba * 7L ) + ( ndx * 13 ) + salt );
+}
+
+//*************************************************************
+//
+// test_check() - compare numSect sectors of testBuf with the
+//                test pattern.
+//
+//*************************************************************
+
+static int test_check( unsigned long lba, long numSect, int salt )
+
+{
+   unsigned char sect[512];
+   long ndx;
+
+   for ( ndx = 0; ndx < numSect; ndx ++ )
+   {
+      test_fill( sect, lba + ndx, salt );
+      if ( memcmp( testBuf + ( ndx * 512L ), sect, 512 ) )
+      {
+         printf( "  data mismatch at LBA %lu\n", (unsigned long) ( lba + ndx ) );
+         return 1;
+      }
+   }
+   return 0;
+}
+
+//*************************************************************
+//
+// test_result() - report a check.
+//
+//*************************************************************
+
+static void test_result( char * name, int rc, int fail )
+
+{
+
+   if ( rc || fail )
+   {
+      printf( "FAIL %s (rc %d, status %02X, error %02X)\n",
+              name, rc, reg_cmd_info.st2, reg_cmd_info.er2 );
+      testErrors ++ ;
+   }
+   else
+      printf( "ok   %s\n", name );
+}
+
+//*************************************************************
+//
+// test_make_image() - write the image file.
+//
+//*************************************************************
+
+static int test_make_image( char * fileName )
+
+{
+   FILE * fp;
+   unsigned char sect[512];
+   unsigned long lba;
+
+   fp = fopen( fileName, "wb" );
+   if ( ! fp )
+      return 1;
+   for ( lba = 0; lba < (unsigned long) TEST_SECTORS; lba ++ )
+   {
+      test_fill( sect, lba, 0 );
+      if ( fwrite( sect, 1, 512, fp ) != 512 )
+      {
+         fclose( fp );
+         return 1;
+      }
+   }
+   fclose( fp );
+   return 0;
+}
+
+//*************************************************************
+//
+// test_bench() - time TEST_BENCH_MB of reads in 64KB commands.
+//
+//*************************************************************
+
+static void test_bench( char * name, int dma )
+
+{
+   clock_t start;
+   double secs;
+   long loop;
+   long numCmds;
+   int rc;
+
+   numCmds = TEST_BENCH_MB * 16L;
+   rc = 0;
+   start = clock();
+   for ( loop = 0; ( loop < numCmds ) && ! rc; loop ++ )
+   {
+      if ( dma )
+         rc = dma_pci_lba48( 0, CMD_READ_DMA_EXT, 0, 128, 0L,
+                             (unsigned long) ( ( loop * 128L ) % ( TEST_SECTORS - 128L ) ),
+                             FP_SEG( testBuf ), FP_OFF( testBuf ), 128L );
+      else
+         rc = reg_pio_data_in_lba48( 0, CMD_READ_SECTORS_EXT, 0, 128, 0L,
+                                     (unsigned long) ( ( loop * 128L ) % ( TEST_SECTORS - 128L ) ),
+                                     FP_SEG( testBuf ), FP_OFF( testBuf ), 128L, 0 );
+   }
+   secs = (double) ( clock() - start ) / CLOCKS_PER_SEC;
+   if ( rc )
+   {
+      test_result( name, rc, 0 );
+      return;
+   }
+   printf( "     %s: %ld commands, %.3fs, %.1f MB/s, %.2f us/command\n",
+           name, numCmds, secs,
+           secs > 0.0 ? (double) TEST_BENCH_MB / secs : 0.0,
+           ( secs * 1000000.0 ) / (double) numCmds );
+}
+
+//*************************************************************
+//
+// main()
+//
+//*************************************************************
+
+int main( int argc, char * argv[] )
+
+{
+   char * fileName;
+   unsigned int * idData;
+   unsigned long numSect;
+   long ndx;
+   int rc;
+
+   fileName = argc > 1 ? argv[1] : "emutest.img";
+   if ( test_make_image( fileName ) || emu_open( fileName ) )
+   {
+      printf( "FAIL unable to create or open %s\n", fileName );
+      return 1;
+   }
+   reg_buffer_size = TEST_BUF_SIZE;
+
+   // device 0 must be found as an ATA device
+
+   reg_config();
+   test_result( "reg_config", 0, reg_config_info[0] != REG_CONFIG_TYPE_ATA );
+
+   rc = reg_reset( 0, 0 );
+   test_result( "reg_reset", rc, 0 );
+
+   // IDENTIFY DEVICE: LBA48 capacity (words 100-103)
+
+   memset( testBuf, 0, 512 );
+   rc = reg_pio_data_in_lba28( 0, CMD_IDENTIFY_DEVICE, 0, 0, 0L,
+                               FP_SEG( testBuf ), FP_OFF( testBuf ), 1L, 0 );
+   idData = (unsigned int *) testBuf;
+   numSect = ( (unsigned long) ( idData[101] & 0xffff ) << 16 ) | ( idData[100] & 0xffff );
+   test_result( "IDENTIFY DEVICE", rc, numSect != (unsigned long) TEST_SECTORS );
+
+   // PIO data in
+
+   rc = reg_pio_data_in_lba48( 0, CMD_READ_SECTORS_EXT, 0, 8, 0L, 100L,
+                               FP_SEG( testBuf ), FP_OFF( testBuf ), 8L, 0 );
+   test_result( "READ SECTORS EXT", rc, rc ? 0 : test_check( 100L, 8L, 0 ) );
+
+   rc = reg_non_data_lba28( 0, CMD_SET_MULTIPLE_MODE, 0, 8, 0L );
+   test_result( "SET MULTIPLE MODE", rc, 0 );
+
+   rc = reg_pio_data_in_lba48( 0, CMD_READ_MULTIPLE_EXT, 0, 64, 0L, 1000L,
+                               FP_SEG( testBuf ), FP_OFF( testBuf ), 64L, 8 );
+   test_result( "READ MULTIPLE EXT", rc, rc ? 0 : test_check( 1000L, 64L, 0 ) );
+
+   // PIO data out, read back with PIO data in
+
+   for ( ndx = 0; ndx < 16L; ndx ++ )
+      test_fill( testBuf + ( ndx * 512L ), 200L + ndx, 1 );
+   rc = reg_pio_data_out_lba48( 0, CMD_WRITE_SECTORS_EXT, 0, 16, 0L, 200L,
+                                FP_SEG( testBuf ), FP_OFF( testBuf ), 16L, 0 );
+   test_result( "WRITE SECTORS EXT", rc, 0 );
+   memset( testBuf, 0, 16 * 512 );
+   rc = reg_pio_data_in_lba48( 0, CMD_READ_SECTORS_EXT, 0, 16, 0L, 200L,
+                               FP_SEG( testBuf ), FP_OFF( testBuf ), 16L, 0 );
+   test_result( "READ SECTORS EXT (written data)", rc, rc ? 0 : test_check( 200L, 16L, 1 ) );
+
+   // PCI DMA: the emulated BMIDE registers and the PRD list,
+   // DMA commands need interrupt mode (the emulator posts the
+   // interrupt to the channel table, no handler runs)
+
+   rc = dma_pci_config( EMU_BMIDE_ADDR );
+   test_result( "dma_pci_config", rc, 0 );
+   rc = int_enable_irq( 0, 14, EMU_BMIDE_ADDR + BM_STATUS_REG,
+                        EMU_BASE_ADDR1 + CB_STAT );
+   test_result( "int_enable_irq", rc, 0 );
+
+   memset( testBuf, 0, TEST_BUF_SIZE );
+   rc = dma_pci_lba48( 0, CMD_READ_DMA_EXT, 0, 128, 0L, 2000L,
+                       FP_SEG( testBuf ), FP_OFF( testBuf ), 128L );
+   test_result( "READ DMA EXT", rc, rc ? 0 : test_check( 2000L, 128L, 0 ) );
+
+   for ( ndx = 0; ndx < 32L; ndx ++ )
+      test_fill( testBuf + ( ndx * 512L ), 3000L + ndx, 2 );
+   rc = dma_pci_lba48( 0, CMD_WRITE_DMA_EXT, 0, 32, 0L, 3000L,
+                       FP_SEG( testBuf ), FP_OFF( testBuf ), 32L );
+   test_result( "WRITE DMA EXT", rc, 0 );
+   memset( testBuf, 0, 32 * 512 );
+   rc = dma_pci_lba48( 0, CMD_READ_DMA_EXT, 0, 32, 0L, 3000L,
+                       FP_SEG( testBuf ), FP_OFF( testBuf ), 32L );
+   test_result( "READ DMA EXT (written data)", rc, rc ? 0 : test_check( 3000L, 32L, 2 ) );
+
+   // reads beyond the end of the image fail
+
+   rc = dma_pci_lba48( 0, CMD_READ_DMA_EXT, 0, 8, 0L, TEST_SECTORS - 4L,
+                       FP_SEG( testBuf ), FP_OFF( testBuf ), 8L );
+   test_result( "READ DMA EXT beyond the last LBA fails", 0, ! rc );
+
+   // driver overhead at memory speed
+
+   if ( ! testErrors )
+   {
+      test_bench( "PIO READ SECTORS EXT", 0 );
+      test_bench( "DMA READ DMA EXT", 1 );
+   }
+
+   int_disable_irq();
+   emu_close();
+   remove( fileName );
+
+   printf( "%s: %d error(s)\n", testErrors ? "FAIL" : "PASS", testErrors );
+   return testErrors ? 1 : 0;
+}
+
+// end emutest.c
@@ -0,0 +1,182 @@
+//********************************************************************
+// ATA LOW LEVEL I/O DRIVER -- host/hoststub.c
+//
+// The hardware stubs of the host (Linux) build, see host/dos.h.
+//
+// The host has no I/O ports, no interrupt controller, no PCI BIOS
+// and no DOS memory. The register traffic of the reg_* and
+// dma_pci_* functions goes to the emulated device (emu_open()
+// selects its backend), so nothing here is used while the
+// emulator is attached. The stubs only keep the hardware backend
+// and the DOS code of the driver linkable:
+//
+//    - port reads return 0xff (no device), port writes are lost.
+//    - int86() fails (there is no PCI BIOS).
+//    - _dos_allocmem() fails (dma_pci_alloc_buf() and
+//      dma_alloc_aligned_buf() return an error).
+//    - the Watcom #pragma aux in-line functions do nothing, the
+//      CPUID functions report no TSC (tmr_read_us() uses the
+//      BIOS tick count, see tmr_read_bios_timer()).
+//********************************************************************
+
+#include <dos.h>
+
+#include "ataio.h"
+
+//*************************************************************
+//
+// Port I/O and interrupt control
+//
+//*************************************************************
+
+unsigned int inp( unsigned int port )
+
+{
+
+   return 0xff;
+}
+
+unsigned int inpw( unsigned int port )
+
+{
+
+   return 0xffff;
+}
+
+unsigned int outp( unsigned int port, unsigned int data )
+
+{
+
+   return data;
+}
+
+unsigned int outpw( unsigned int port, unsigned int data )
+
+{
+
+   return data;
+}
+
+void _enable( void )
+
+{
+}
+
+void _disable( void )
+
+{
+}
+
+//*************************************************************
+//
+// BIOS and DOS calls
+//
+//*************************************************************
+
+int int86( int intNum, union REGS * in, union REGS * out )
+
+{
+
+   * out = * in;
+   out->x.cflag = 1;
+   return out->x.ax;
+}
+
+static void ( * hostVect[256] ) ();
+
+void ( * _dos_getvect( unsigned int intNum ) ) ()
+
+{
+
+   return hostVect[ intNum & 0xff ];
+}
+
+void _dos_setvect( unsigned int intNum, void ( * handler ) () )
+
+{
+
+   hostVect[ intNum & 0xff ] = handler;
+}
+
+unsigned int _dos_allocmem( unsigned int paras, unsigned int * seg )
+
+{
+
+   * seg = 0;
+   return 8;            // DOS error 8: insufficient memory
+}
+
+unsigned int _dos_freemem( unsigned int seg )
+
+{
+
+   return 0;
+}
+
+unsigned int _dos_setblock( unsigned int paras, unsigned int seg, unsigned int * maxParas )
+
+{
+
+   * maxParas = 0;
+   return 8;
+}
+
+unsigned int _dos_commit( int handle )
+
+{
+
+   return 0;
+}
+
+int kbhit( void )
+
+{
+
+   return 0;
+}
+
+int getch( void )
+
+{
+
+   return 0;
+}
+
+//*************************************************************
+//
+// The Watcom #pragma aux in-line functions (ATAIOPIO.C,
+// ATAIOINT.C, ATAIOPCI.C and ATAIOTMR.C).
+//
+//*************************************************************
+
+void PreserveAXDX( void ) { }
+void RestoreDXAX( void ) { }
+void PreserveAXCXDXDIES( void ) { }
+void RestoreESDIDXCXAX( void ) { }
+void PreserveAXCXDXSIDS( void ) { }
+void RestoreDSSIDXCXAX( void ) { }
+
+unsigned char AsmInpB( int regAddr ) { return 0xff; }
+unsigned int AsmInpW( int regAddr ) { return 0xffff; }
+void AsmOutpB( int regAddr, unsigned char data ) { }
+void AsmOutpW( int regAddr, unsigned int data ) { }
+
+void ReadBlockPIOB( unsigned int bufSeg, unsigned int bufOff, unsigned int bCnt, unsigned int dataRegAddr ) { }
+void ReadBlockPIOW( unsigned int bufSeg, unsigned int bufOff, unsigned int wCnt, unsigned int dataRegAddr ) { }
+void ReadBlockPIOD( unsigned int bufSeg, unsigned int bufOff, unsigned int dwCnt, unsigned int dataRegAddr ) { }
+void WriteBlockPIOB( unsigned int bufSeg, unsigned int bufOff, unsigned int bCnt, unsigned int dataRegAddr ) { }
+void WriteBlockPIOW( unsigned int bufSeg, unsigned int bufOff, unsigned int wCnt, unsigned int dataRegAddr ) { }
+void WriteBlockPIOD( unsigned int bufSeg, unsigned int bufOff, unsigned int dwCnt, unsigned int dataRegAddr ) { }
+
+void PopAll( void ) { }
+void ChainInt( void ) { }
+
+void pci_sti_hlt( void ) { }
+
+unsigned int tmr_cpuid_ok( void ) { return 0; }
+unsigned int tmr_cpuid_tsc( void ) { return 0; }
+unsigned long tmr_cpuid_sig( void ) { return 0L; }
+unsigned long tmr_rdtsc_low( void ) { return 0L; }
+unsigned long tmr_tsc_us( unsigned long perUs ) { return 0L; }
+
+// end hoststub.c
@@ -0,0 +1,3 @@
+// host build: <i86.h> is part of the <dos.h> shim
+
+#include <dos.h>
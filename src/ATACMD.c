@@ -102,6 +102,8 @@
 // -----------------------------------------------------------------------------
 
 int GetAndSendATACommand( void );
+int ParseNumbers( const char* pArgs, unsigned long* pNumbers, int maxNumbers );
+int ParseLBA48( const char* pArg, unsigned long* pLBA, unsigned long* pLBAHigh );
 
 int ClearBuffer( const char* pCommand );
 int FillBuffer( const char* pCommand );
@@ -134,6 +136,24 @@ int SmartAttributes( const char* pCommand );
 int CheckCommand( const char* pCommand );
 int EnablePolling( const char* pCommand );
 int DisablePolling( const char* pCommand );
+int EmulatedDevice( const char* pCommand );
+int TraceMode( const char* pCommand );
+int TraceCost( const char* pCommand );
+int TaskfileShadow( const char* pCommand );
+int MultiDeviceRead( const char* pCommand );
+int StreamRead( const char* pCommand );
+int PipelinedRead( const char* pCommand );
+int DMAHaltMode( const char* pCommand );
+int TimerSource( const char* pCommand );
+int TimeoutProfile( const char* pCommand );
+int TraceBinary( const char* pCommand );
+int TraceDecode( const char* pCommand );
+int CommandStatistics( const char* pCommand );
+int InterruptChannels( const char* pCommand );
+int ScanSurface( const char* pCommand );
+int DataPattern( const char* pCommand );
+int VerifyPattern( const char* pCommand );
+int PIOWidth( const char* pCommand );
 
 // -----------------------------------------------------------------------------
 // Structs
@@ -150,6 +170,10 @@ struct tEachCommand
 // -----------------------------------------------------------------------------
 
 static char wcCommand[ NUMBER_OF_CHARACTERS_IN_DOS_LINE ] = { 0 };
+static char wcStatsFile[ 80 ] = { 0 };    // command statistics written here at exit
+static int wkPattern = PATTERN_LBA;       // pattern of "write", "verify" and "fillbuf pat"
+static unsigned long wgPatternSeed = 0;   // fill word or xorshift32 seed of wkPattern
+static int wkPatternSet = FALSE;          // FALSE = "write" fills with the LBA's low byte
 
 // ****************************************************************
 //  Add new macro commands to wtAtacmdCommands command array here!
@@ -185,9 +209,24 @@ struct tEachCommand wtAtacmdCommands[] = {
    [27].pName = "chkcmd",  [27].pFunctionPtr = &CheckCommand,
    [28].pName = "pollen",  [28].pFunctionPtr = &EnablePolling,
    [29].pName = "polldis", [29].pFunctionPtr = &DisablePolling,
-//   [30].pName = "", [30].pFunctionPtr = &,
-//   [31].pName = "", [31].pFunctionPtr = &,
-//   [32].pName = "", [32].pFunctionPtr = &,
+   [30].pName = "emu",     [30].pFunctionPtr = &EmulatedDevice,
+   [31].pName = "trcmode", [31].pFunctionPtr = &TraceMode,
+   [32].pName = "trccost", [32].pFunctionPtr = &TraceCost,
+   [33].pName = "shadow",  [33].pFunctionPtr = &TaskfileShadow,
+   [34].pName = "multi",   [34].pFunctionPtr = &MultiDeviceRead,
+   [35].pName = "stream",  [35].pFunctionPtr = &StreamRead,
+   [36].pName = "pread",   [36].pFunctionPtr = &PipelinedRead,
+   [37].pName = "dmahlt",  [37].pFunctionPtr = &DMAHaltMode,
+   [38].pName = "timer",   [38].pFunctionPtr = &TimerSource,
+   [39].pName = "tmo",     [39].pFunctionPtr = &TimeoutProfile,
+   [40].pName = "trcbin",  [40].pFunctionPtr = &TraceBinary,
+   [41].pName = "trcdec",  [41].pFunctionPtr = &TraceDecode,
+   [42].pName = "stats",   [42].pFunctionPtr = &CommandStatistics,
+   [43].pName = "irq",     [43].pFunctionPtr = &InterruptChannels,
+   [44].pName = "scan",    [44].pFunctionPtr = &ScanSurface,
+   [45].pName = "pattern", [45].pFunctionPtr = &DataPattern,
+   [46].pName = "verify",  [46].pFunctionPtr = &VerifyPattern,
+   [47].pName = "piowidth", [47].pFunctionPtr = &PIOWidth,
 };
 
 // -----------------------------------------------------------------------------
@@ -223,6 +262,91 @@ void PrintSuccess( int commandSuccess )
    }
 }
 
+//------------------------------------------------------------------------------
+// Description: Parse up to maxNumbers unsigned numbers (decimal or 0x hex)
+//              separated by spaces. Unlike sscanf's %li, LBAs from 80000000h
+//              to FFFFFFFFh are not clamped.
+//
+// Input:  pArgs        - arguments after the command name
+//         pNumbers     - parsed numbers, entries not given are left as they are
+//         maxNumbers   - size of pNumbers
+// Output: number of numbers parsed
+//------------------------------------------------------------------------------
+int ParseNumbers( const char* pArgs, unsigned long* pNumbers, int maxNumbers )
+{
+   int numParsed = 0;
+   char* pEnd;
+   unsigned long value;
+
+   while ( numParsed < maxNumbers ) {
+      while ( *pArgs == ' ' ) {
+         pArgs++;
+      }
+      if ( ( *pArgs < '0' ) || ( *pArgs > '9' ) ) {
+         break;
+      }
+      value = strtoul( pArgs, &pEnd, 0 );
+      if ( ( *pEnd != ' ' ) && ( *pEnd != '\0' ) ) {
+         break;
+      }
+      pNumbers[ numParsed++ ] = value;
+      pArgs = pEnd;
+   }
+
+   return ( numParsed );
+}
+
+//------------------------------------------------------------------------------
+// Description: Parse a 48-bit LBA (decimal or 0x hex). The number is built in
+//              16-bit pieces, so no 64-bit integer is needed.
+//
+// Input:  pArg         - the number, nothing may follow it
+//         pLBA         - gets LBA bits 31:0
+//         pLBAHigh     - gets LBA bits 47:32
+// Output: NO_ERROR, ERROR = not a number or more than 48 bits
+//------------------------------------------------------------------------------
+int ParseLBA48( const char* pArg, unsigned long* pLBA, unsigned long* pLBAHigh )
+{
+   unsigned long piece[ 3 ], digit, base;
+   int eachPiece;
+
+   base = 10;
+   if ( ( pArg[ 0 ] == '0' ) && ( ( pArg[ 1 ] == 'x' ) || ( pArg[ 1 ] == 'X' ) ) ) {
+      base = 16;
+      pArg += 2;
+   }
+   if ( *pArg == '\0' ) {
+      return ( ERROR );
+   }
+
+   piece[ 0 ] = piece[ 1 ] = piece[ 2 ] = 0;
+   for ( ; *pArg != '\0'; pArg++ ) {
+      if ( ( *pArg >= '0' ) && ( *pArg <= '9' ) ) {
+         digit = *pArg - '0';
+      } else if ( ( base == 16 ) && ( *pArg >= 'A' ) && ( *pArg <= 'F' ) ) {
+         digit = *pArg - 'A' + 10;
+      } else if ( ( base == 16 ) && ( *pArg >= 'a' ) && ( *pArg <= 'f' ) ) {
+         digit = *pArg - 'a' + 10;
+      } else {
+         return ( ERROR );
+      }
+
+      // value = value * base + digit, least significant piece first
+      for ( eachPiece = 2; eachPiece >= 0; eachPiece-- ) {
+         digit += piece[ eachPiece ] * base;
+         piece[ eachPiece ] = digit & 0xFFFFL;
+         digit >>= 16;
+      }
+      if ( digit != 0 ) {
+         return ( ERROR );
+      }
+   }
+
+   *pLBAHigh = piece[ 0 ];
+   *pLBA = ( piece[ 1 ] << 16 ) | piece[ 2 ];
+   return ( NO_ERROR );
+}
+
 //------------------------------------------------------------------------------
 // Description: Clear global I/O buffer.
 //
@@ -231,13 +355,15 @@ void PrintSuccess( int commandSuccess )
 //------------------------------------------------------------------------------
 int ClearBuffer( const char* pCommand )
 {
-    memset( buffer, 0, sizeof( buffer ) );
+    memset( buffer, 0, BUFFER_SIZE );
     
     return ( NO_ERROR );
 }
 
 //------------------------------------------------------------------------------
-// Description: Fill global I/O buffer with byte value.
+// Description: Fill global I/O buffer with byte value, or with the data
+//              pattern (see "pattern") from an LBA on.
+//              >>fillbuf <byte> | pat [<LBA>]
 //
 // Input:  pCommand     - user command line input
 // Output: NO_ERROR
@@ -245,10 +371,21 @@ int ClearBuffer( const char* pCommand )
 int FillBuffer( const char* pCommand )
 {
    int value;
+   unsigned long lba;
+   const char* pArgs = pCommand + strlen( "fillbuf" );
 
-   value = strtol( ( pCommand + strlen( "fillbuf" ) + 1 ), NULL, 0 );
-   
-   memset( buffer, ( value & 0xFF ), sizeof( buffer ) );
+   while ( *pArgs == ' ' ) {
+      pArgs++;
+   }
+
+   if ( !TOOLS_StringCompareIgnoreCase( pArgs, "pat", 3 ) ) {
+      lba = 0;
+      ParseNumbers( ( pArgs + strlen( "pat" ) ), &lba, 1 );
+      FillPattern( buffer, BUFFER_SIZE, wkPattern, wgPatternSeed, lba );
+   } else {
+      value = strtol( pArgs, NULL, 0 );
+      FillPattern( buffer, BUFFER_SIZE, PATTERN_CONSTANT, ( ( value & 0xFF ) * 0x01010101L ), 0L );
+   }
    
    return ( NO_ERROR );
 }
@@ -300,6 +437,337 @@ int TraceClear( const char* pCommand )
    return ( NO_ERROR );
 }
 
+//------------------------------------------------------------------------------
+// Description: Set the driver low level trace mode: 0 = trace everything,
+//              1 = command start/end and errors only, 2 = no trace.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR
+//------------------------------------------------------------------------------
+int TraceMode( const char* pCommand )
+{
+   int mode;
+
+   mode = strtol( ( pCommand + strlen( "trcmode" ) + 1 ), NULL, 0 );
+
+   trc_llt_set_mode( mode );
+   printf( "Low level trace mode: %d", trc_llt_mode );
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Starts or stops the binary command trace log.
+//              >>trcbin <file>  Logs every command to <file> (new file)
+//              >>trcbin flush   Writes the buffered records now
+//              >>trcbin off     Writes the buffered records and closes the file
+//              The records are written at the prompt, and between the
+//              commands of a scan when the buffer is half full, never while a
+//              command runs.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int TraceBinary( const char* pCommand )
+{
+   char fileName[ 80 ];
+
+   fileName[ 0 ] = '\0';
+   sscanf( ( pCommand + strlen( "trcbin" ) ), " %79s", fileName );
+
+   if ( !TOOLS_StringCompareIgnoreCase( fileName, "off", 4 ) ) {
+      trc_bin_close();
+   } else if ( !TOOLS_StringCompareIgnoreCase( fileName, "flush", 6 ) ) {
+      trc_bin_flush();
+   } else if ( fileName[ 0 ] != '\0' ) {
+      if ( trc_bin_open( fileName, ON ) ) {
+         printf( "ERROR: can not create %s", fileName );
+         return ( ERROR );
+      }
+      printf( "Logging commands to %s\n", fileName );
+   }
+
+   printf( "%ld records written, %ld dropped", trc_bin_written, trc_bin_dropped );
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Decodes a binary command trace log.
+//              >>trcdec <file> [<text file>]  Prints to the screen if no text
+//              file is given.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int TraceDecode( const char* pCommand )
+{
+   char inName[ 80 ];
+   char outName[ 80 ];
+   int numNames;
+
+   numNames = sscanf( ( pCommand + strlen( "trcdec" ) ), " %79s %79s", inName, outName );
+
+   if ( ( numNames < 1 ) || trc_bin_decode( inName, ( numNames > 1 ) ? outName : NULL ) ) {
+      printf( "ERROR: can not decode the trace log" );
+      return ( ERROR );
+   }
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Measure the cost of one register access (Alt Status read) in
+//              each low level trace mode. Each mode is timed for one second.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR
+//------------------------------------------------------------------------------
+int TraceCost( const char* pCommand )
+{
+   int mode, saveMode, loop;
+   long count, startTime, endTime;
+   long accessNs[ TRC_LLT_MODE_NONE + 1 ];
+
+   saveMode = trc_llt_mode;
+
+   for ( mode = TRC_LLT_MODE_ALL; mode <= TRC_LLT_MODE_NONE; mode++ )
+   {
+      trc_llt_set_mode( mode );
+
+      // Measure again if the timer passed midnight before the first reads
+      do
+      {
+         // Start on a timer tick
+         startTime = tmr_read_bios_timer();
+         while ( tmr_read_bios_timer() == startTime ) {}
+         endTime = startTime + 1L + 18L;
+
+         // Stop after one second (or if the timer passes midnight)
+         count = 0;
+         while ( ( tmr_read_bios_timer() < endTime ) && ( tmr_read_bios_timer() >= startTime ) )
+         {
+            for ( loop = 0; loop < 100; loop++ ) {
+               pio_inbyte( CB_ASTAT );
+            }
+            count += 100;
+         }
+      } while ( count == 0 );
+
+      accessNs[ mode ] = 1000000000L / count;
+      printf( "\nTrace mode %d: %ld reads/s, %ld ns per read", mode, count, accessNs[ mode ] );
+   }
+
+   printf( "\nSaved per access: %ld ns (mode 1), %ld ns (mode 2)",
+           accessNs[ TRC_LLT_MODE_ALL ] - accessNs[ TRC_LLT_MODE_CMDS ],
+           accessNs[ TRC_LLT_MODE_ALL ] - accessNs[ TRC_LLT_MODE_NONE ] );
+
+   trc_llt_set_mode( saveMode );
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Turn taskfile shadowing on ("shadow 1") or off ("shadow 0").
+//              When on, the driver skips taskfile register writes that would
+//              not change the register value.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR
+//------------------------------------------------------------------------------
+int TaskfileShadow( const char* pCommand )
+{
+   if ( strlen( pCommand ) > strlen( "shadow" ) ) {
+      reg_shadow_flag = strtol( ( pCommand + strlen( "shadow" ) + 1 ), NULL, 0 ) ? 1 : 0;
+      sub_shadow_invalidate();
+   }
+   printf( "Taskfile shadow: %s", reg_shadow_flag ? "on" : "off" );
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Read from all found devices at the same time and print the
+//              aggregate throughput. >>multi <v|r|d> <commands> [sectors]
+//              v = READ VERIFY SECTORS EXT, r = READ SECTORS EXT (PIO),
+//              d = READ DMA EXT. Each device starts at LBA 0.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int MultiDeviceRead( const char* pCommand )
+{
+   static struct SchedJob_t wtJobs[ MAX_STORAGE_DEVICES ];
+   char mode;
+   long commands, sectors, ticks, startTime;
+   unsigned int eachDevice, numJobs;
+   unsigned long totalSectors;
+   int commandSuccess;
+
+   mode = 'v';
+   commands = 0;
+   sectors = 64;
+   sscanf( ( pCommand + strlen( "multi" ) ), " %c %ld %ld", &mode, &commands, &sectors );
+
+   if ( ( commands <= 0 ) || ( sectors <= 0 ) || ( sectors > 65535L ) ||
+        ( ( mode != 'v' ) && ( sectors > ( BUFFER_SIZE / 512 ) ) ) ) {
+      printf( "Usage: multi <v|r|d> <commands> [sectors]" );
+      return ( ERROR );
+   }
+
+   numJobs = 0;
+   for ( eachDevice = 0; eachDevice < MAX_STORAGE_DEVICES; eachDevice++ ) {
+      struct StorageDevice_t* pDeviceInfo = GetDeviceInfo( eachDevice );
+
+      if ( ( pDeviceInfo != NULL ) && ( pDeviceInfo->valid == VALID_DEVICE_ENTRY ) ) {
+         wtJobs[ numJobs ].deviceIndex = eachDevice;
+         wtJobs[ numJobs ].prot = ( mode == 'r' ) ? ASY_PROT_PDI : ( mode == 'd' ) ? ASY_PROT_DMA : ASY_PROT_ND;
+         wtJobs[ numJobs ].cmd = ( mode == 'r' ) ? CMD_READ_SECTORS_EXT : ( mode == 'd' ) ? CMD_READ_DMA_EXT : CMD_READ_VERIFY_SECTORS_EXT;
+         wtJobs[ numJobs ].lba = 0L;
+         wtJobs[ numJobs ].lbaHigh = 0L;
+         wtJobs[ numJobs ].sectorsPerCmd = (unsigned int) sectors;
+         wtJobs[ numJobs ].commandsLeft = commands;
+         numJobs++;
+      }
+   }
+
+   printf( "Running %ld commands of %ld sectors on %u devices...", commands, sectors, numJobs );
+
+   startTime = tmr_read_bios_timer();
+   RunScheduledJobs( wtJobs, numJobs );
+   ticks = tmr_read_bios_timer() - startTime;
+   if ( ticks <= 0 ) {
+      ticks = 1;
+   }
+
+   commandSuccess = NO_ERROR;
+   totalSectors = 0;
+   for ( eachDevice = 0; eachDevice < numJobs; eachDevice++ ) {
+      printf( "\nDev# %u: %ld commands done", ( wtJobs[ eachDevice ].deviceIndex + 1 ), wtJobs[ eachDevice ].commandsDone );
+      if ( wtJobs[ eachDevice ].errorCode != 0 ) {
+         printf( ", error %d at LBA %lu", wtJobs[ eachDevice ].errorCode, wtJobs[ eachDevice ].lba );
+         commandSuccess = ERROR;
+      }
+      totalSectors += wtJobs[ eachDevice ].lba;
+   }
+
+   // 18.2 ticks per second: KB/s = ( sectors / 2 ) * 18.2 / ticks
+   printf( "\nTotal: %lu KB in %ld ticks, %lu KB/s", ( totalSectors / 2 ), ticks,
+           ( ( totalSectors / 2 ) * 182L ) / ( ticks * 10L ) );
+
+   return ( commandSuccess );
+}
+
+//------------------------------------------------------------------------------
+// Description: Adds one streamed DRQ block to a 32-bit checksum.
+//
+// Input:  pBlock       - DRQ block data
+//         numBytes     - DRQ block size
+//         pContext     - unsigned long checksum
+// Output: None
+//------------------------------------------------------------------------------
+static void StreamChecksumBlock( unsigned char far* pBlock, long numBytes, void* pContext )
+{
+   unsigned long* pChecksum = (unsigned long*) pContext;
+   unsigned int far* pWord = (unsigned int far*) pBlock;
+   long eachWord;
+
+   for ( eachWord = 0; eachWord < ( numBytes / 2 ); eachWord++ ) {
+      *pChecksum += pWord[ eachWord ];
+   }
+}
+
+//------------------------------------------------------------------------------
+// Description: Read up to 65536 sectors with one PIO command and print a
+//              checksum of the data. >>stream <LBA> <sectors>
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int StreamRead( const char* pCommand )
+{
+   int commandSuccess;
+   unsigned long lba, sectors, checksum;
+   unsigned long args[ 2 ] = { 0, 0 };
+   long startTime, ticks;
+
+   ParseNumbers( ( pCommand + strlen( "stream" ) ), args, 2 );
+   lba = args[ 0 ];
+   sectors = args[ 1 ];
+
+   if ( ( sectors < 1 ) || ( sectors > STREAM_MAX_SECTORS ) ) {
+      printf( "Usage: stream <LBA> <sectors 1-%ld>", STREAM_MAX_SECTORS );
+      return ( ERROR );
+   }
+
+   printf( "Streaming %lu sectors from LBA %lu (%lXh)...", sectors, lba, lba );
+
+   checksum = 0;
+   startTime = tmr_read_bios_timer();
+   commandSuccess = StreamSectorsInLBA48( lba, sectors, &StreamChecksumBlock, &checksum );
+   ticks = tmr_read_bios_timer() - startTime;
+   if ( ticks <= 0 ) {
+      ticks = 1;
+   }
+
+   PrintSuccess( commandSuccess );
+
+   if ( commandSuccess == NO_ERROR ) {
+      // 18.2 ticks per second: KB/s = ( sectors / 2 ) * 18.2 / ticks
+      printf( "\nChecksum %08lXh, %lu KB in %ld ticks, %lu KB/s", checksum, ( sectors / 2 ), ticks,
+              ( ( sectors / 2 ) * 182L ) / ( ticks * 10L ) );
+   }
+
+   return ( commandSuccess );
+}
+
+//------------------------------------------------------------------------------
+// Description: Read sectors with double-buffered READ DMA EXT commands and
+//              print a checksum of the data. >>pread <LBA> <sectors> [per cmd]
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int PipelinedRead( const char* pCommand )
+{
+   int commandSuccess;
+   unsigned long lba, sectors, perCmd, checksum;
+   unsigned long args[ 3 ] = { 0, 0, PIPE_MAX_SECTORS_PER_CMD };
+   long startTime, ticks;
+
+   ParseNumbers( ( pCommand + strlen( "pread" ) ), args, 3 );
+   lba = args[ 0 ];
+   sectors = args[ 1 ];
+   perCmd = args[ 2 ];
+
+   if ( ( sectors < 1 ) || ( perCmd < 1 ) ) {
+      printf( "Usage: pread <LBA> <sectors> [sectors per command, default %d]", PIPE_MAX_SECTORS_PER_CMD );
+      return ( ERROR );
+   }
+
+   printf( "Pipelined DMA read of %lu sectors from LBA %lu (%lXh), %lu per command...", sectors, lba, lba, perCmd );
+
+   checksum = 0;
+   startTime = tmr_read_bios_timer();
+   commandSuccess = PipelinedReadDMA( lba, sectors, (unsigned int) perCmd, &StreamChecksumBlock, &checksum );
+   ticks = tmr_read_bios_timer() - startTime;
+   if ( ticks <= 0 ) {
+      ticks = 1;
+   }
+
+   PrintSuccess( commandSuccess );
+
+   if ( commandSuccess == NO_ERROR ) {
+      // 18.2 ticks per second: KB/s = ( sectors / 2 ) * 18.2 / ticks
+      printf( "\nChecksum %08lXh, %lu KB in %ld ticks, %lu KB/s", checksum, ( sectors / 2 ), ticks,
+              ( ( sectors / 2 ) * 182L ) / ( ticks * 10L ) );
+   } else {
+      printf( "\nFailed at LBA %lu", ugReturnValue1 );
+   }
+
+   return ( commandSuccess );
+}
+
 int EnablePolling( const char* pCommand )
 {
    ATAIOREG_EnablePollForPIOCompletion();
@@ -314,6 +782,76 @@ int DisablePolling( const char* pCommand )
    return ( NO_ERROR );
 }
 
+//------------------------------------------------------------------------------
+// Description: Shows or sets the PIO transfer width of the active device.
+//              >>piowidth [cal|16]  "cal" times 16 and 32-bit PIO in the
+//              device's sector buffer (READ/WRITE BUFFER, the media is not
+//              touched) and picks 32-bit only if it is verified and faster.
+//              A failed 32-bit transfer resets both devices on the channel.
+//              "16" goes back to 16-bit PIO (the default).
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR
+//------------------------------------------------------------------------------
+int PIOWidth( const char* pCommand )
+{
+   char option[ 4 ];
+   struct StorageDevice_t* pDevice;
+
+   option[ 0 ] = '\0';
+   sscanf( ( pCommand + strlen( "piowidth" ) ), " %3s", option );
+
+   if ( !TOOLS_StringCompareIgnoreCase( option, "cal", 4 ) ) {
+      printf( "Calibrating..." );
+      CalibratePIOWidth();
+   } else if ( !TOOLS_StringCompareIgnoreCase( option, "16", 3 ) ) {
+      pDevice = GetDeviceInfo( uActiveDeviceIndex );
+      if ( pDevice != NULL ) {
+         pDevice->pioWidth = 16;
+      }
+      pio_xfer_width = 16;
+   }
+
+   printf( "PIO transfer width: %d-bit", pio_xfer_width );
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Attach an emulated ATA device backed by a sector image file
+//              ("emu <file>"), or detach it and go back to the active HDD
+//              ("emu").
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int EmulatedDevice( const char* pCommand )
+{
+   if ( strlen( pCommand ) <= strlen( "emu" ) ) {
+      emu_close();
+      SetActiveDevice( uActiveDeviceIndex );
+      printf( "Active HDD: " );
+      PrintModelString();
+      return ( NO_ERROR );
+   }
+
+   DisableInterrupt();
+   dma_pci_enabled_flag = 0;
+
+   if ( emu_open( (char *) ( pCommand + strlen( "emu" ) + 1 ) ) ) {
+      printf( "Unable to open image file!!!" );
+      return ( ERROR );
+   }
+
+   reg_config();
+   ukDevicePosition = MASTER;
+
+   printf( "Emulated HDD: " );
+   PrintModelString();
+
+   return ( NO_ERROR );
+}
+
 int CheckCommand( const char* pCommand )
 {
    int commandSuccess;
@@ -326,7 +864,10 @@ int CheckCommand( const char* pCommand )
 }
 
 //------------------------------------------------------------------------------
-// Description: Issues PCI DMA read, e.g. READ DMA EXT
+// Description: Issues PCI DMA read, e.g. READ DMA EXT. >>rdma <LBA> [sectors]
+//              Up to 65536 sectors in one command, the read speed is printed
+//              for more than one sector. Above BUFFER_SIZE the data is not kept
+//              in the buffer (see ReadDMA()).
 //
 // Input:  pCommand     - user command line input
 // Output: NO_ERROR, ERROR
@@ -334,25 +875,174 @@ int CheckCommand( const char* pCommand )
 int RDMA( const char* pCommand )
 {
    int commandSuccess;
-   unsigned long lba;
+   unsigned long lba, sectors;
+   unsigned long args[ 2 ] = { 0, 1 };
+   long startTime, ticks;
 
-   lba = strtol( ( pCommand + strlen( "rdma" ) + 1 ), NULL, 0 );
+   ParseNumbers( ( pCommand + strlen( "rdma" ) ), args, 2 );
+   lba = args[ 0 ];
+   sectors = args[ 1 ];
 
-   printf( "Reading LBA %lu (%lXh)...", lba, lba );
+   printf( "Reading %lu sectors from LBA %lu (%lXh)...", sectors, lba, lba );
 
    // Read LBA
-   ReadDMA( lba, 1 ); commandSuccess = ukReturnValue1;
+   startTime = tmr_read_bios_timer();
+   ReadDMA( lba, sectors ); commandSuccess = ukReturnValue1;
+   ticks = tmr_read_bios_timer() - startTime;
+   if ( ticks <= 0 ) {
+      ticks = 1;
+   }
 
    PrintSuccess( commandSuccess );
 
+   if ( ( commandSuccess == NO_ERROR ) && ( sectors > 1 ) ) {
+      // 18.2 ticks per second: KB/s = ( sectors / 2 ) * 18.2 / ticks
+      printf( "\n%lu KB in %ld ticks, %lu KB/s", ( sectors / 2 ), ticks,
+              ( ( sectors / 2 ) * 182L ) / ( ticks * 10L ) );
+   }
+
+   if ( ( commandSuccess == NO_ERROR ) && ( reg_cmd_info.intrLatency != 0 ) ) {
+      printf( "\nINTRQ latency %lu us", reg_cmd_info.intrLatency );
+   }
+
    if ( commandSuccess == NO_ERROR ) {
+      printf( "\nCommand time %lu us", ( reg_cmd_info.endTime - reg_cmd_info.startTime ) );
+   }
+
+   if ( ( commandSuccess == NO_ERROR ) && ( ( sectors * 512L ) <= BUFFER_SIZE ) ) {
       printf( "\n" );
       PrintDataBufferHex( PRINT_64_BYTES, PRINT_BYTE );
+   } else if ( commandSuccess == NO_ERROR ) {
+      printf( "\nMore than %d sectors: the data is not in the buffer, viewbuf shows old data", ( BUFFER_SIZE / 512 ) );
    }
 
    return ( commandSuccess );
 }
 
+//------------------------------------------------------------------------------
+// Description: Selects how PCI DMA commands wait for the end of the command.
+//              >>dmahlt [on|off]  "on" halts the CPU until the interrupt, no
+//              register reads during the transfer. "off" polls (default).
+//              "on" needs an interrupt channel ("irq on"), channels without
+//              one keep polling.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR = no interrupt channel enabled
+//------------------------------------------------------------------------------
+int DMAHaltMode( const char* pCommand )
+{
+   char mode[ 4 ];
+   int eachChannel, numChannels;
+
+   mode[ 0 ] = '\0';
+   sscanf( ( pCommand + strlen( "dmahlt" ) ), " %3s", mode );
+
+   if ( !TOOLS_StringCompareIgnoreCase( mode, "on", 2 ) ) {
+      numChannels = 0;
+      for ( eachChannel = 0; eachChannel < INT_MAX_CHANNELS; eachChannel++ ) {
+         if ( int_chan[ eachChannel ].irqNum != 0 ) {
+            numChannels++;
+         }
+      }
+      if ( numChannels == 0 ) {
+         printf( "ERROR: no IRQ enabled, use \"irq on\" first" );
+         return ( ERROR );
+      }
+      if ( int_find_channel( pio_base_addr1 + 7 ) < 0 ) {
+         printf( "WARNING: no IRQ on this channel, its DMA commands poll\n" );
+      }
+      reg_incompat_flags |= REG_INCOMPAT_DMA_HLT;
+   } else if ( !TOOLS_StringCompareIgnoreCase( mode, "off", 3 ) ) {
+      reg_incompat_flags &= ~REG_INCOMPAT_DMA_HLT;
+   }
+
+   printf( "DMA completion: %s", ( reg_incompat_flags & REG_INCOMPAT_DMA_HLT ) ? "HLT until interrupt" : "polling" );
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Selects the time source for the microsecond command time stamps
+//              and shows the time stamps of the last command.
+//              >>timer [bios|pit|tsc|cal]  The best available source up to the
+//              one given is used, "tsc" (default) falls back to "pit" and
+//              "bios". "cal" redoes the delay calibration without the cache file.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR
+//------------------------------------------------------------------------------
+int TimerSource( const char* pCommand )
+{
+   char source[ 5 ];
+
+   source[ 0 ] = '\0';
+   sscanf( ( pCommand + strlen( "timer" ) ), " %4s", source );
+
+   if ( !TOOLS_StringCompareIgnoreCase( source, "bios", 4 ) ) {
+      tmr_init_time_source( TMR_SRC_BIOS );
+   } else if ( !TOOLS_StringCompareIgnoreCase( source, "pit", 3 ) ) {
+      tmr_init_time_source( TMR_SRC_PIT );
+   } else if ( !TOOLS_StringCompareIgnoreCase( source, "tsc", 3 ) ) {
+      tmr_init_time_source( TMR_SRC_TSC );
+   } else if ( !TOOLS_StringCompareIgnoreCase( source, "cal", 3 ) ) {
+      tmr_calibrate( 0 );
+      printf( "Delay counts: %ld per ms\n", tmr_1ms_count );
+   }
+
+   if ( tmr_time_source == TMR_SRC_TSC ) {
+      printf( "Time source: TSC, %lu MHz", tmr_tsc_per_us );
+   } else if ( tmr_time_source == TMR_SRC_PIT ) {
+      printf( "Time source: PIT channel 0" );
+   } else {
+      printf( "Time source: BIOS ticks (55 ms)" );
+   }
+
+   // Time stamps of the previous command
+   printf( "\nLast command: %lu us", ( reg_cmd_info.endTime - reg_cmd_info.startTime ) );
+   if ( reg_cmd_info.drqPackets != 0 ) {
+      printf( ", first DRQ after %lu us", ( reg_cmd_info.drqTime - reg_cmd_info.startTime ) );
+   }
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Sets or shows the command time out profiles.
+//              >>tmo [<command code> <seconds>]  Sets the time out of a command
+//              code, 0 seconds removes it. Without arguments the profile of
+//              every command code and command class is listed.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int TimeoutProfile( const char* pCommand )
+{
+   unsigned long cmd;
+   long seconds;
+   int eachCode, eachClass;
+
+   if ( sscanf( ( pCommand + strlen( "tmo" ) ), " %li %li", &cmd, &seconds ) == 2 ) {
+      if ( ( cmd > 0xFF ) || ( seconds < 0 ) || tmr_set_cmd_code_timeout( (unsigned char) cmd, seconds ) ) {
+         printf( "ERROR: invalid command code or time out table full" );
+         return ( ERROR );
+      }
+   }
+
+   printf( "Default time out: %ld s", tmr_get_command_timeout() );
+   for ( eachCode = 0; eachCode <= 0xFF; eachCode++ ) {
+      if ( tmr_get_cmd_code_timeout( (unsigned char) eachCode ) != 0 ) {
+         printf( "\nCommand %02Xh ....: %ld s", eachCode, tmr_get_cmd_code_timeout( (unsigned char) eachCode ) );
+      }
+   }
+   for ( eachClass = 0; eachClass < TRC_TYPE_ALL; eachClass++ ) {
+      if ( tmr_get_cmd_class_timeout( eachClass ) != 0 ) {
+         printf( "\nClass %d ........: %ld s", eachClass, tmr_get_cmd_class_timeout( eachClass ) );
+      }
+   }
+
+   return ( NO_ERROR );
+}
+
 //------------------------------------------------------------------------------
 // Description: Displays general info about the selected device.
 //
@@ -667,7 +1357,7 @@ int SecurityDisable( const char* pCommand )
 int SecurityErase( const char* pCommand )
 {
    int returnStatus;
-   unsigned int originalTimeout, newTimeoutInSeconds;
+   long eraseTimeoutInSeconds;
    unsigned int normalEraseTimeInMin;
    const char* pPassword = ( pCommand + strlen( "erase" ) + 1 );
 
@@ -684,17 +1374,13 @@ int SecurityErase( const char* pCommand )
    if ( returnStatus == NO_ERROR ) {
       char inChar;
       
+      // IDENTIFY DEVICE also sets the erase time out profile, 2x the expected
+      // time or the default, overkill time allowance
       GetEstimatedSecureEraseTimesInMin(); normalEraseTimeInMin = ukReturnValue1;
-      originalTimeout = tmr_get_command_timeout();
-      
-      if ( normalEraseTimeInMin == 0 ) {
-         newTimeoutInSeconds = ( DEFAULT_ERASE_TIME_IN_MINUTES * 60 );     // use default, overkill time allowance
-      } else {
-         newTimeoutInSeconds = ( 2 * ( normalEraseTimeInMin * 60 ) );      // 2x the expected time just in case
-      }
+      eraseTimeoutInSeconds = tmr_get_cmd_code_timeout( CMD_SECURITY_ERASE_UNIT );
      
-      printf( "Expected erase time: %d seconds (%d minutes)\n", ( normalEraseTimeInMin * 60 ), normalEraseTimeInMin );
-      printf( "Command timeout ...: %d seconds (%d minutes)\n", newTimeoutInSeconds, ( newTimeoutInSeconds / 60 ) );
+      printf( "Expected erase time: %ld seconds (%u minutes)\n", ( normalEraseTimeInMin * 60L ), normalEraseTimeInMin );
+      printf( "Command timeout ...: %ld seconds (%ld minutes)\n", eraseTimeoutInSeconds, ( eraseTimeoutInSeconds / 60L ) );
       
       printf( "\nProceed with erase? (Y/N)" );
       scanf( "%c", &inChar );
@@ -704,7 +1390,6 @@ int SecurityErase( const char* pCommand )
          char* pTimeStr;
          
          TOOLS_GetTime( &pTimeStr );
-         tmr_set_command_timeout( newTimeoutInSeconds );
          DISPLAY_InstallClock();
          
          printf( "Executing security erase at %s...", pTimeStr );
@@ -718,7 +1403,6 @@ int SecurityErase( const char* pCommand )
          }
          
          DISPLAY_UninstallClock();
-         tmr_set_command_timeout( originalTimeout );
       }
    }
    
@@ -839,7 +1523,7 @@ int DcoSetLBA( const char* pCommand )
    unsigned long lba;
 
    
-   lba = strtol( ( pCommand + strlen( "dco" ) + 1 ), NULL, 0 );   
+   lba = strtoul( ( pCommand + strlen( "dco" ) + 1 ), NULL, 0 );   
    printf( "Setting DCO to LBA %lu (%lXh)...", lba, lba );
    ChangeDriveCapacityViaDCO( lba ); commandSuccess = ukReturnValue1;
 
@@ -859,7 +1543,7 @@ int HpaSetLBA( const char* pCommand )
    int commandSuccess;
    unsigned long lba;
 
-   lba = strtol( ( pCommand + strlen( "hpa" ) + 1 ), NULL, 0 );   
+   lba = strtoul( ( pCommand + strlen( "hpa" ) + 1 ), NULL, 0 );   
 
    printf( "Setting HPA to LBA %lu (%lXh)...", lba, lba );
    SetHPA( ON, HPA_NON_VOLATILE, lba); commandSuccess = ukReturnValue1;
@@ -931,7 +1615,7 @@ int RPIO( const char* pCommand )
    int commandSuccess;
    unsigned long lba;
 
-   lba = strtol( ( pCommand + strlen( "read" ) + 1 ), NULL, 0 );   
+   lba = strtoul( ( pCommand + strlen( "read" ) + 1 ), NULL, 0 );   
 
    printf( "Reading LBA %lu (%lXh)...", lba, lba );
 
@@ -949,7 +1633,10 @@ int RPIO( const char* pCommand )
 }
 
 //------------------------------------------------------------------------------
-// Description: Issues a 1 block PIO write to the selected lba. >>write <LBA>
+// Description: Issues a PIO write of the data pattern (see "pattern") to the
+//              selected lba. Without a pattern set, each sector is filled with
+//              the LBA's low byte and starts with the LBA.
+//              >>write <LBA> [<sectors>]
 //
 // Input:  pCommand     - user command line input
 // Output: NO_ERROR, ERROR
@@ -957,27 +1644,405 @@ int RPIO( const char* pCommand )
 int WPIO( const char* pCommand )
 {
    int commandSuccess;
-   unsigned long lba;
-
-   lba = strtol( ( pCommand + strlen( "write" ) + 1 ), NULL, 0 );   
+   unsigned long lba, sectors;
+   unsigned long args[ 2 ] = { 0, 1 };
+
+   ParseNumbers( ( pCommand + strlen( "write" ) ), args, 2 );
+   lba = args[ 0 ];
+   sectors = args[ 1 ];
+   if ( sectors == 0 ) {
+      sectors = 1;
+   } else if ( sectors > ( BUFFER_SIZE / 512 ) ) {
+      sectors = BUFFER_SIZE / 512;
+   }
 
    // Write data
-   memset( buffer, lba, sizeof( buffer ) );
-   buffer[0] = ( lba & 0xFF );
-   buffer[1] = ( ( lba >> 8 ) & 0xFF );
-   buffer[2] = ( ( lba >> 16 ) & 0xFF );
-   buffer[3] = ( ( lba >> 24 ) & 0xFF );
+   if ( wkPatternSet == FALSE ) {
+      FillPattern( buffer, BUFFER_SIZE, PATTERN_LBA, ( ( lba & 0xFF ) * 0x01010101L ), lba );
+   } else {
+      FillPattern( buffer, BUFFER_SIZE, wkPattern, wgPatternSeed, lba );
+   }
 
-   printf( "Writing %lXh to LBA %lu...", lba, lba );
+   printf( "Writing %lu sectors to LBA %lu (%lXh)...", sectors, lba, lba );
 
    // Write LBA
-   WriteSectorsInLBA48( lba, 1 ); commandSuccess = ukReturnValue1;
+   WriteSectorsInLBA48( lba, sectors ); commandSuccess = ukReturnValue1;
+
+   PrintSuccess( commandSuccess );
+
+   return ( commandSuccess );
+}
+
+//------------------------------------------------------------------------------
+// Description: Prints the command time histogram bucket limit, e.g. "<512us".
+//
+// Input:  pFile        - output file
+//         bucket       - histogram bucket, see REG_STATS_BUCKETS
+// Output: None
+//------------------------------------------------------------------------------
+static void PrintBucketLimit( FILE* pFile, int bucket )
+{
+   unsigned long limitUs = ( 2UL << bucket );
+
+   if ( bucket >= ( REG_STATS_BUCKETS - 1 ) ) {
+      fprintf( pFile, ">=%lums", ( limitUs / 2UL ) / 1000UL );
+   } else if ( limitUs < 1000UL ) {
+      fprintf( pFile, "<%luus", limitUs );
+   } else {
+      fprintf( pFile, "<%lums", limitUs / 1000UL );
+   }
+}
+
+//------------------------------------------------------------------------------
+// Description: Prints the histogram bucket that holds a percentile of the
+//              command times.
+//
+// Input:  pFile        - output file
+//         pStats       - command code statistics
+//         notAbove     - number of commands allowed above the percentile
+// Output: None
+//------------------------------------------------------------------------------
+static void PrintPercentile( FILE* pFile, struct REG_CMD_STATS* pStats, unsigned long notAbove )
+{
+   int bucket;
+   unsigned long total = 0;
+
+   for ( bucket = 0; bucket < ( REG_STATS_BUCKETS - 1 ); bucket++ ) {
+      total += pStats->hist[ bucket ];
+      if ( total >= ( pStats->count - notAbove ) ) {
+         break;
+      }
+   }
+   fprintf( pFile, " " );
+   PrintBucketLimit( pFile, bucket );
+}
+
+//------------------------------------------------------------------------------
+// Description: Prints the statistics of every command code used so far: count,
+//              errors, time outs, MB transferred, the longest command time,
+//              the 50%, 99% and 99.9% command times and the histogram.
+//
+// Input:  pFile        - output file
+// Output: None
+//------------------------------------------------------------------------------
+static void PrintCommandStatistics( FILE* pFile )
+{
+   char wPrinted[ TRC_NUM_CMDS ];
+   unsigned int cc, ndx;
+   int bucket;
+
+   memset( wPrinted, 0, sizeof( wPrinted ) );
+
+   fprintf( pFile, "Cmd Name                  Count Errors T/Os      MB  Max(us) p50/p99/p99.9\n" );
+
+   // Several (unknown) codes can share an entry, print each entry once
+   for ( cc = 0; cc <= 0xFF; cc++ ) {
+      struct REG_CMD_STATS* pStats;
+
+      ndx = TRC_CC2NDX( cc );
+      pStats = &reg_cmd_stats[ ndx ];
+      if ( ( pStats->count == 0 ) || wPrinted[ ndx ] ) {
+         continue;
+      }
+      wPrinted[ ndx ] = 1;
+
+      fprintf( pFile, "%02X  %-18.18s %8lu %6lu %4lu %7lu %8lu",
+               ( ndx != 0 ) ? cc : 0, ( ndx != 0 ) ? (char*) trc_get_cmd_name( cc ) : "(other)",
+               pStats->count, pStats->errors, pStats->timeOuts, pStats->xferMB, pStats->maxUs );
+      PrintPercentile( pFile, pStats, pStats->count / 2UL );
+      PrintPercentile( pFile, pStats, pStats->count / 100UL );
+      PrintPercentile( pFile, pStats, pStats->count / 1000UL );
+      fprintf( pFile, "\n   " );
+
+      for ( bucket = 0; bucket < REG_STATS_BUCKETS; bucket++ ) {
+         if ( pStats->hist[ bucket ] != 0 ) {
+            PrintBucketLimit( pFile, bucket );
+            fprintf( pFile, ":%lu ", pStats->hist[ bucket ] );
+         }
+      }
+      fprintf( pFile, "\n" );
+   }
+}
+
+//------------------------------------------------------------------------------
+// Description: Shows, clears or saves the per command code statistics.
+//              >>stats          Shows the statistics
+//              >>stats clear    Clears them
+//              >>stats <file>   Appends them to <file> now and at exit
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int CommandStatistics( const char* pCommand )
+{
+   char fileName[ 80 ];
+   FILE* pFile;
+
+   fileName[ 0 ] = '\0';
+   sscanf( ( pCommand + strlen( "stats" ) ), " %79s", fileName );
+
+   if ( !TOOLS_StringCompareIgnoreCase( fileName, "clear", 6 ) ) {
+      ATAIOREG_ClearCommandStatistics();
+      printf( "Command statistics cleared" );
+   } else if ( fileName[ 0 ] != '\0' ) {
+      pFile = fopen( fileName, "a" );
+      if ( pFile == NULL ) {
+         printf( "ERROR: can not open %s", fileName );
+         return ( ERROR );
+      }
+      PrintCommandStatistics( pFile );
+      fclose( pFile );
+      strcpy( wcStatsFile, fileName );
+      printf( "Command statistics written to %s (again at exit)", fileName );
+   } else {
+      PrintCommandStatistics( stdout );
+   }
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Shows the driver's interrupt channel table, every channel in it
+//              is serviced by the interrupt handlers at the same time.
+//              >>irq          Shows the table (* = active channel)
+//              >>irq on       Sets up interrupt mode for the active device
+//              >>irq off      Takes its channel out of the table
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int InterruptChannels( const char* pCommand )
+{
+   char option[ 4 ];
+   int eachChannel;
+   int returnStatus = NO_ERROR;
+
+   option[ 0 ] = '\0';
+   sscanf( ( pCommand + strlen( "irq" ) ), " %3s", option );
+
+   if ( !TOOLS_StringCompareIgnoreCase( option, "on", 3 ) ) {
+      returnStatus = EnableInterrupt();
+   } else if ( !TOOLS_StringCompareIgnoreCase( option, "off", 4 ) ) {
+      DisableInterrupt();
+   }
+
+   printf( "\n  IRQ ATA  BMIDE Shared Interrupts" );
+   for ( eachChannel = 0; eachChannel < INT_MAX_CHANNELS; eachChannel++ ) {
+      if ( int_chan[ eachChannel ].irqNum != 0 ) {
+         printf( "\n%c %3d %04X %04X  %-6s %d",
+                 ( eachChannel == int_chan_active ) ? '*' : ' ',
+                 int_chan[ eachChannel ].irqNum,
+                 int_chan[ eachChannel ].ataAddr,
+                 int_chan[ eachChannel ].bmAddr,
+                 int_chan[ eachChannel ].shared ? "yes" : "no",
+                 int_chan[ eachChannel ].intrCntr );
+      }
+   }
+
+   return ( returnStatus );
+}
+
+//------------------------------------------------------------------------------
+// Description: Scans the surface of the active device and writes a bad block /
+//              slow block map (see SurfaceScan()).
+//              >>scan [dma] [<map file> [<start LBA> [<end LBA>]]]
+//              READ VERIFY SECTORS EXT is used unless "dma" is given (READ DMA
+//              EXT into the scratch buffer). The map file defaults to
+//              ATASCAN.MAP and the end LBA to the native max LBA. LBAs are
+//              48-bit, decimal or 0x hex.
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int ScanSurface( const char* pCommand )
+{
+   struct ScanResult_t tResult;
+   char mapFile[ 80 ], startArg[ 16 ], endArg[ 16 ];
+   char startString[ LBA48_STRING_SIZE ], endString[ LBA48_STRING_SIZE ];
+   const char* pArgs;
+   unsigned long startLBA, startLBAHigh, endLBA, endLBAHigh;
+   int useDMA, numArgs, commandSuccess;
+
+   pArgs = pCommand + strlen( "scan" );
+   while ( *pArgs == ' ' ) {
+      pArgs++;
+   }
+   useDMA = OFF;
+   if ( !TOOLS_StringCompareIgnoreCase( pArgs, "dma", 3 ) && ( ( pArgs[ 3 ] == ' ' ) || ( pArgs[ 3 ] == '\0' ) ) ) {
+      useDMA = ON;
+      pArgs += 3;
+   }
+
+   // 48-bit LBAs (decimal or 0x hex)
+   strcpy( mapFile, "ATASCAN.MAP" );
+   startLBA = 0;
+   startLBAHigh = 0;
+   numArgs = sscanf( pArgs, " %79s %15s %15s", mapFile, startArg, endArg );
+   if ( ( numArgs >= 2 ) && ( ParseLBA48( startArg, &startLBA, &startLBAHigh ) != NO_ERROR ) ) {
+      printf( "ERROR: bad start LBA %s", startArg );
+      return ( ERROR );
+   }
+
+   if ( numArgs >= 3 ) {
+      if ( ParseLBA48( endArg, &endLBA, &endLBAHigh ) != NO_ERROR ) {
+         printf( "ERROR: bad end LBA %s", endArg );
+         return ( ERROR );
+      }
+   } else {
+      GetMaxLBAFromReadNativeMax();
+      if ( ukReturnValue1 != NO_ERROR ) {
+         printf( "ERROR: can not read the native max LBA" );
+         return ( ERROR );
+      }
+      endLBA = ugReturnValue1;
+      endLBAHigh = ugReturnValue2;
+   }
+
+   printf( "\nScanning LBA %s to %s with %s, map in %s...\n",
+           FormatLBA48( startString, startLBAHigh, startLBA ), FormatLBA48( endString, endLBAHigh, endLBA ),
+           ( useDMA == ON ) ? "READ DMA EXT" : "READ VERIFY SECTORS EXT", mapFile );
+
+   commandSuccess = SurfaceScan( startLBA, startLBAHigh, endLBA, endLBAHigh, useDMA, 0L, mapFile, &tResult );
 
    PrintSuccess( commandSuccess );
 
+   if ( tResult.ticks <= 0 ) {
+      tResult.ticks = 1;
+   }
+   // 18.2 ticks per second: MB/s = ( sectors / 2048 ) * 18.2 / ticks
+   printf( "\n%s sectors to LBA %s in %ld ticks, %lu MB/s",
+           FormatLBA48( startString, tResult.sectorsScannedHigh, tResult.sectorsScanned ),
+           FormatLBA48( endString, tResult.lastLBAHigh, tResult.lastLBA ), tResult.ticks,
+           ( ( ( tResult.sectorsScannedHigh << 21 ) | ( tResult.sectorsScanned >> 11 ) ) * 91L ) / ( tResult.ticks * 5L ) );
+   printf( "\n%lu bad sectors, %lu slow chunks, %lu retried chunks, %lu commands", tResult.badSectors,
+           tResult.slowChunks, tResult.retriedChunks, tResult.commands );
+   if ( tResult.stopped == TRUE ) {
+      printf( "\nStopped early (IDNF past the end of the device or too many bad sectors)" );
+   }
    return ( commandSuccess );
 }
 
+//------------------------------------------------------------------------------
+// Description: Sets the data pattern of "write", "verify" and "fillbuf pat", or
+//              prints it. Patterns are made a 32-bit word at a time:
+//              const    - every word is the byte repeated
+//              lba      - each sector starts with its LBA, then the byte
+//              rnd      - xorshift32 per sector from the seed and the LBA
+//              >>pattern [const <byte> | lba <byte> | rnd <seed>]
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR
+//------------------------------------------------------------------------------
+int DataPattern( const char* pCommand )
+{
+   char type[ 8 ] = { 0 };
+   unsigned long value;
+   int numArgs, typeEnd;
+   const char* pArgs = pCommand + strlen( "pattern" );
+
+   value = 0;
+   numArgs = sscanf( pArgs, " %7s%n", type, &typeEnd );
+
+   if ( numArgs >= 1 ) {
+      ParseNumbers( ( pArgs + typeEnd ), &value, 1 );
+      if ( !TOOLS_StringCompareIgnoreCase( type, "const", 6 ) ) {
+         wkPattern = PATTERN_CONSTANT;
+         wgPatternSeed = ( value & 0xFF ) * 0x01010101L;
+      } else if ( !TOOLS_StringCompareIgnoreCase( type, "lba", 4 ) ) {
+         wkPattern = PATTERN_LBA;
+         wgPatternSeed = ( value & 0xFF ) * 0x01010101L;
+      } else if ( !TOOLS_StringCompareIgnoreCase( type, "rnd", 4 ) ) {
+         wkPattern = PATTERN_RANDOM;
+         wgPatternSeed = value;
+      } else {
+         printf( "Usage: pattern [const <byte> | lba <byte> | rnd <seed>]" );
+         return ( ERROR );
+      }
+      wkPatternSet = TRUE;
+   }
+
+   if ( wkPatternSet == FALSE ) {
+      printf( "Pattern: LBA, filled with the LBA's low byte" );
+   } else if ( wkPattern == PATTERN_CONSTANT ) {
+      printf( "Pattern: constant %08lXh", wgPatternSeed );
+   } else if ( wkPattern == PATTERN_LBA ) {
+      printf( "Pattern: LBA, filled with %08lXh", wgPatternSeed );
+   } else {
+      printf( "Pattern: xorshift32, seed %08lXh", wgPatternSeed );
+   }
+
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Reads sectors (PIO or DMA) and checks them against the data
+//              pattern (see "pattern") a 32-bit word at a time. Prints the
+//              first mismatch.
+//              >>verify [dma] <LBA> [<sectors>]
+//
+// Input:  pCommand     - user command line input
+// Output: NO_ERROR, ERROR = read failed or data mismatch
+//------------------------------------------------------------------------------
+int VerifyPattern( const char* pCommand )
+{
+   int commandSuccess, useDMA;
+   unsigned long lba, sectors, seed;
+   unsigned long args[ 2 ];
+   long mismatch;
+   const char* pArgs = pCommand + strlen( "verify" );
+
+   while ( *pArgs == ' ' ) {
+      pArgs++;
+   }
+
+   useDMA = FALSE;
+   if ( !TOOLS_StringCompareIgnoreCase( pArgs, "dma", 3 ) && ( ( pArgs[ 3 ] == ' ' ) || ( pArgs[ 3 ] == '\0' ) ) ) {
+      useDMA = TRUE;
+      pArgs += 3;
+   }
+
+   args[ 0 ] = 0;
+   args[ 1 ] = 1;
+   ParseNumbers( pArgs, args, 2 );
+   lba = args[ 0 ];
+   sectors = args[ 1 ];
+   if ( sectors == 0 ) {
+      sectors = 1;
+   } else if ( sectors > ( BUFFER_SIZE / 512 ) ) {
+      sectors = BUFFER_SIZE / 512;
+   }
+
+   printf( "Verifying %lu sectors from LBA %lu (%lXh)...", sectors, lba, lba );
+
+   if ( useDMA == TRUE ) {
+      ReadDMA( lba, sectors ); commandSuccess = ukReturnValue1;
+   } else {
+      ReadSectorsInLBA48( lba, sectors ); commandSuccess = ukReturnValue1;
+   }
+
+   if ( commandSuccess != NO_ERROR ) {
+      PrintSuccess( commandSuccess );
+      return ( commandSuccess );
+   }
+
+   // Without a pattern set the fill byte comes from the LBA, so verify from the LBA written
+   if ( wkPatternSet == FALSE ) {
+      seed = ( lba & 0xFF ) * 0x01010101L;
+      mismatch = ComparePattern( buffer, ( sectors * 512L ), PATTERN_LBA, seed, lba );
+   } else {
+      mismatch = ComparePattern( buffer, ( sectors * 512L ), wkPattern, wgPatternSeed, lba );
+   }
+
+   if ( mismatch < 0 ) {
+      printf( "Data matches" );
+      return ( NO_ERROR );
+   }
+
+   printf( "Mismatch at LBA %lu byte %ld: expected %08lXh, read %08lXh", ( lba + ( mismatch / 512L ) ), ( mismatch % 512L ),
+           ugReturnValue1, ugReturnValue2 );
+   return ( ERROR );
+}
+
 //------------------------------------------------------------------------------
 // Description: Checks user input to a command support by this program, then
 //              executes it.
@@ -1000,10 +2065,14 @@ int DoCommand( const char* pCommand )
 
       numAtacmdCommands = ( sizeof( wtAtacmdCommands ) / sizeof( struct tEachCommand ) );
 
-      // Search through all the user-defined ATA command macros
+      // Search through all the user-defined ATA command macros, the name must
+      // be followed by a space or the end of the line ("trc" vs. "trcmode")
       for ( eachAtacmdCommand = 0; eachAtacmdCommand < numAtacmdCommands; eachAtacmdCommand++ )
       {
-         if ( !TOOLS_StringCompareIgnoreCase( pCommand, wtAtacmdCommands[ eachAtacmdCommand ].pName, strlen( wtAtacmdCommands[ eachAtacmdCommand ].pName ) ) ) {
+         int nameLength = strlen( wtAtacmdCommands[ eachAtacmdCommand ].pName );
+
+         if (    !TOOLS_StringCompareIgnoreCase( pCommand, wtAtacmdCommands[ eachAtacmdCommand ].pName, nameLength )
+              && ( ( pCommand[ nameLength ] == '\0' ) || ( pCommand[ nameLength ] == ' ' ) ) ) {
             commandFound = TRUE;
             
             commandSuccess = (* wtAtacmdCommands[ eachAtacmdCommand ].pFunctionPtr)( pCommand );
@@ -1049,6 +2118,9 @@ int main( void )
 
    while ( 1 )
    {
+      // No command in flight, write the binary trace log records
+      trc_bin_flush();
+
       printf( ">" );
 
       while ( 1 )
@@ -1089,6 +2161,16 @@ int main( void )
       printf( "\n" );
    }
 
+   // Save the command statistics if "stats <file>" was used
+   if ( wcStatsFile[ 0 ] != '\0' ) {
+      FILE* pFile = fopen( wcStatsFile, "a" );
+
+      if ( pFile != NULL ) {
+         PrintCommandStatistics( pFile );
+         fclose( pFile );
+      }
+   }
+
    ATALIB_CleanUp();
 
    return 0;
@@ -34,8 +34,10 @@
 // -----------------------------
 // * This program was not created for performance and therefore shouldn't be
 // used as the basis for an IOPS or throughput test.
-// * This library currently is not configured to operate on more than one HDD
-// at a time.
+// * Devices without security support are overwritten with OVERWRITE_FILL_BYTE
+// instead, all of them at once through the command scheduler (see
+// RunScheduledJobs()), one DMA command per channel at a time. An overwrite
+// waits while its channel runs a security erase. Needs 48-bit addressing.
 // * There is currently no support for SCSI or enterprise devices. Those drives
 // use a different protocol for sending/receiving commands. Visit:
 // http://www.t10.org/ for more information.
@@ -88,7 +90,14 @@
 
 #define DEFAULT_MASTER_PASSWORD                    ( "ataerase" )
 #define TIME_DELAY_BETWEEN_CHECKS_IN_SECONDS       ( 10 )
-#define ERASE_TIMEOUT_IN_SECONDS                   ( 12 * 60 * 60 )      // 12 hours
+#define ERASE_TIMEOUT_IN_SECONDS                   ( 12L * 60L * 60L )   // 12 hours
+#define OVERWRITE_FILL_BYTE                        ( 0x00 )
+#define OVERWRITE_SLICE_SECTORS                    ( 262144L )           // 128MB per device between progress lines
+
+// wActiveDevices values
+#define ACTIVE_NONE                                ( 0 )
+#define ACTIVE_ERASE                               ( 1 )                 // security erase in progress
+#define ACTIVE_OVERWRITE                           ( 2 )                 // overwrite in progress
 
 // -----------------------------------------------------------------------------
 // Local function declarations
@@ -105,6 +114,10 @@
 // Global Variables
 // -----------------------------------------------------------------------------
 
+struct SchedJob_t wOverwriteJobs[ MAX_STORAGE_DEVICES ];    // one per device, commandsLeft = 0 if idle
+unsigned long wOverwriteEnd[ MAX_STORAGE_DEVICES ];         // native max LBA + 1 (bits 31:0)
+unsigned long wOverwriteEndHigh[ MAX_STORAGE_DEVICES ];     // native max LBA + 1 (bits 47:32)
+int wProgressLineShown = OFF;                               // overwrite progress ends the current line
 
 // -----------------------------------------------------------------------------
 // Local Functions
@@ -139,6 +152,179 @@ void PrintSuccess( int commandSuccess )
    }
 }
 
+//------------------------------------------------------------------------------
+// Description: Ends the overwrite progress line, so the next message starts on
+//              a new line.
+//
+// Input:  None
+// Output: None
+//------------------------------------------------------------------------------
+void EndProgressLine()
+{
+   if ( wProgressLineShown == ON ) {
+      printf( "\n" );
+      wProgressLineShown = OFF;
+   }
+}
+
+//------------------------------------------------------------------------------
+// Description: Sets up the overwrite of a device without security support.
+//
+// Input:  eachDevice   - device index
+// Output: NO_ERROR = overwrite set up; ERROR = device can't be overwritten
+//------------------------------------------------------------------------------
+int StartOverwrite( int eachDevice )
+{
+   struct SchedJob_t* pJob = &wOverwriteJobs[ eachDevice ];
+   char maxLBAString[ LBA48_STRING_SIZE ];
+
+   printf( "Setting up overwrite..." );
+   if ( OverwriteJobSetup( eachDevice, pJob ) == ERROR ) {
+      printf( "No 48-bit addressing! Aborting.\n" );
+      return ( ERROR );
+   }
+   wOverwriteEnd[ eachDevice ] = ugReturnValue1 + 1L;
+   wOverwriteEndHigh[ eachDevice ] = ugReturnValue2 + ( ( wOverwriteEnd[ eachDevice ] == 0L ) ? 1L : 0L );
+
+   printf( "%s, %u sectors per command, max LBA %s\n",
+           ( pJob->prot == ASY_PROT_DMA ) ? "WRITE DMA EXT" :
+           ( pJob->cmd == CMD_WRITE_MULTIPLE_EXT ) ? "WRITE MULTIPLE EXT" : "WRITE SECTORS EXT",
+           pJob->sectorsPerCmd, FormatLBA48( maxLBAString, ugReturnValue2, ugReturnValue1 ) );
+   pJob->commandsLeft = 0;
+   return ( NO_ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Overwrites the next slice (up to OVERWRITE_SLICE_SECTORS) of
+//              every device being overwritten, all at once, then prints the
+//              total MB/s and the time left for the slowest device. Devices
+//              on a channel running a security erase wait.
+//
+// Input:  pActiveDevices        - wActiveDevices of main()
+//         pOverwritesInProgress - decremented for each device done or failed
+//         startTimeInSec        - start time of the overwrites
+// Output: Number of devices written this slice
+//------------------------------------------------------------------------------
+int OverwriteSlice( char* pActiveDevices, int* pOverwritesInProgress, time_t startTimeInSec )
+{
+   int eachDevice, otherDevice, devicesRun;
+   unsigned long remaining, remainingHigh, doneMB, leftMB, totalMB, elapsed, kbPerSec, etaInSec, deviceEta;
+   struct SchedJob_t* pJob;
+   struct StorageDevice_t* pDeviceInfo;
+   time_t currentTimeInSec;
+   char lbaString[ LBA48_STRING_SIZE ];
+
+   devicesRun = 0;
+   for ( eachDevice = 0; eachDevice < MAX_STORAGE_DEVICES; eachDevice++ ) {
+      pJob = &wOverwriteJobs[ eachDevice ];
+      pJob->commandsLeft = 0;
+      if ( pActiveDevices[ eachDevice ] != ACTIVE_OVERWRITE ) {
+         continue;
+      }
+
+      // Skip while the channel is busy with an erase
+      pDeviceInfo = GetDeviceInfo( eachDevice );
+      for ( otherDevice = 0; otherDevice < MAX_STORAGE_DEVICES; otherDevice++ ) {
+         if ( ( pActiveDevices[ otherDevice ] == ACTIVE_ERASE ) &&
+              ( GetDeviceInfo( otherDevice )->cmdBase == pDeviceInfo->cmdBase ) ) {
+            break;
+         }
+      }
+      if ( otherDevice < MAX_STORAGE_DEVICES ) {
+         continue;
+      }
+
+      // Whole commands, the last command of the device gets the rest
+      remaining = wOverwriteEnd[ eachDevice ] - pJob->lba;
+      remainingHigh = wOverwriteEndHigh[ eachDevice ] - pJob->lbaHigh - ( ( wOverwriteEnd[ eachDevice ] < pJob->lba ) ? 1L : 0L );
+      if ( ( remainingHigh != 0L ) || ( remaining > OVERWRITE_SLICE_SECTORS ) ) {
+         remaining = OVERWRITE_SLICE_SECTORS;
+      }
+      pJob->commandsLeft = remaining / pJob->sectorsPerCmd;
+      if ( pJob->commandsLeft == 0 ) {
+         pJob->sectorsPerCmd = (unsigned int) remaining;
+         pJob->commandsLeft = 1;
+      }
+      devicesRun++;
+   }
+
+   if ( devicesRun == 0 ) {
+      return ( 0 );
+   }
+
+   // Commands run in between reuse the global buffer
+   FillDMABuffers( OVERWRITE_FILL_BYTE );
+   RunScheduledJobs( wOverwriteJobs, MAX_STORAGE_DEVICES );
+   trc_bin_idle();
+
+   // Report finished and failed devices
+   for ( eachDevice = 0; eachDevice < MAX_STORAGE_DEVICES; eachDevice++ ) {
+      pJob = &wOverwriteJobs[ eachDevice ];
+      if ( pActiveDevices[ eachDevice ] != ACTIVE_OVERWRITE ) {
+         continue;
+      }
+
+      if ( pJob->errorCode != 0 ) {
+         EndProgressLine();
+         printf( "Overwrite of device %d failed at LBA %s, error %d!\n", ( eachDevice + 1 ),
+                 FormatLBA48( lbaString, pJob->lbaHigh, pJob->lba ), pJob->errorCode );
+      } else if ( ( pJob->lbaHigh > wOverwriteEndHigh[ eachDevice ] ) ||
+                  ( ( pJob->lbaHigh == wOverwriteEndHigh[ eachDevice ] ) && ( pJob->lba >= wOverwriteEnd[ eachDevice ] ) ) ) {
+         char* pTimeStr;
+
+         TOOLS_GetTime( &pTimeStr );
+         EndProgressLine();
+         printf( "Overwrite completed at %s on device %d [", pTimeStr, ( eachDevice + 1 ) );
+         SetActiveDevice( eachDevice );
+         PrintModelString();
+         printf( "]!\n" );
+      } else {
+         continue;
+      }
+
+      fflush( stdout );
+      pActiveDevices[ eachDevice ] = ACTIVE_NONE;
+      ( *pOverwritesInProgress )--;
+   }
+
+   // Total MB/s and the time left for the slowest device
+   time( &currentTimeInSec );
+   if ( ( currentTimeInSec - startTimeInSec ) > 0 ) {
+      elapsed = (unsigned long) ( currentTimeInSec - startTimeInSec );
+      totalMB = 0L;
+      etaInSec = 0L;
+      for ( eachDevice = 0; eachDevice < MAX_STORAGE_DEVICES; eachDevice++ ) {
+         pJob = &wOverwriteJobs[ eachDevice ];
+
+         // In MB (2048 sectors) so 48-bit LBAs fit 32 bits
+         doneMB = ( pJob->lbaHigh << 21 ) | ( pJob->lba >> 11 );
+         totalMB += doneMB;
+         if ( pActiveDevices[ eachDevice ] == ACTIVE_OVERWRITE ) {
+            kbPerSec = ( ( doneMB / elapsed ) * 1024L ) + ( ( ( doneMB % elapsed ) * 1024L ) / elapsed );
+            if ( kbPerSec != 0 ) {
+               remaining = wOverwriteEnd[ eachDevice ] - pJob->lba;
+               remainingHigh = wOverwriteEndHigh[ eachDevice ] - pJob->lbaHigh - ( ( wOverwriteEnd[ eachDevice ] < pJob->lba ) ? 1L : 0L );
+               leftMB = ( remainingHigh << 21 ) | ( remaining >> 11 );
+               deviceEta = ( ( leftMB / kbPerSec ) * 1024L ) + ( ( ( leftMB % kbPerSec ) * 1024L ) / kbPerSec );
+               if ( deviceEta > etaInSec ) {
+                  etaInSec = deviceEta;
+               }
+            }
+         }
+      }
+
+      if ( *pOverwritesInProgress > 0 ) {
+         printf( "\rOverwriting: %lu MB, %lu MB/s, %lu:%02lu:%02lu left  ",
+                 totalMB, totalMB / elapsed,
+                 ( etaInSec / 3600L ), ( ( etaInSec / 60L ) % 60L ), ( etaInSec % 60L ) );
+         fflush( stdout );
+         wProgressLineShown = ON;
+      }
+   }
+
+   return ( devicesRun );
+}
+
 //------------------------------------------------------------------------------
 // Description: Entry point
 //
@@ -160,14 +346,18 @@ int main( void )
    system( "cls" );
 
    if ( exitProgram == OFF ) {
-      int eachDevice, erasesInProgress;
+      int eachDevice, erasesInProgress, overwritesInProgress;
       char wActiveDevices[ MAX_STORAGE_DEVICES ];
+      struct ASY_CMD wEraseCmds[ MAX_STORAGE_DEVICES ];
 
       erasesInProgress = 0;
-      memset( wActiveDevices, 0, MAX_STORAGE_DEVICES );
+      overwritesInProgress = 0;
+      memset( wActiveDevices, ACTIVE_NONE, MAX_STORAGE_DEVICES );
 
-      // Don't hang up program for erase to complete
-      ATAIOREG_DisablePollForPIOCompletion();
+      // Erases are started without waiting and polled below. Each erase gets
+      // the time out profile set from its device's IDENTIFY data (see
+      // GetEstimatedSecureEraseTimesInMin()), ERASE_TIMEOUT_IN_SECONDS limits
+      // the whole program. Overwrites run between the polls.
 
       printf( "ATA Erase v1.0\n" );
       printf( "--------------------------------------------------------------------------------\n" );
@@ -195,7 +385,11 @@ int main( void )
 
             // Start erase
             if ( secSupport == OFF ) {
-               printf( "Not Supported! Aborting.\n" );
+               printf( "Not Supported! Overwriting instead.\n" );
+               if ( StartOverwrite( eachDevice ) == NO_ERROR ) {
+                  wActiveDevices[ eachDevice ] = ACTIVE_OVERWRITE;
+                  overwritesInProgress++;
+               }
             } else {
                printf( "Supported\n" );
                printf( "Setting MASTER password %s...", DEFAULT_MASTER_PASSWORD );
@@ -221,13 +415,13 @@ int main( void )
 
                   printf( "Executing security erase at %s...", pTimeStr );
                   fflush( stdout );
-                  SecureErase( DEFAULT_MASTER_PASSWORD, MASTER_PASSWORD, NORMAL_SECURE_ERASE ); returnStatus = ukReturnValue1;
+                  SecureEraseStart( &wEraseCmds[ eachDevice ], DEFAULT_MASTER_PASSWORD, MASTER_PASSWORD, NORMAL_SECURE_ERASE ); returnStatus = ukReturnValue1;
 
                   if ( returnStatus == ERROR ) {
                      printf( "ERROR! Aborting.\n" );
                   } else {
                      printf( "Issuing command successful\n" );
-                     wActiveDevices[ eachDevice ] = 1;
+                     wActiveDevices[ eachDevice ] = ACTIVE_ERASE;
                      erasesInProgress++;
                   }
                }
@@ -236,10 +430,10 @@ int main( void )
       }
 
       // -----------------------------------------------------------------------
-      // Poll for erase completion
+      // Overwrite and poll for erase completion
       // -----------------------------------------------------------------------
-      if ( erasesInProgress > 0 ) {
-         int eraseInProgress;
+      if ( ( erasesInProgress > 0 ) || ( overwritesInProgress > 0 ) ) {
+         int eraseInProgress, devicesOverwritten;
          time_t startTimeInSec, currentTimeInSec, tempTimeInSec;
 
          // Show running clock on program
@@ -248,22 +442,35 @@ int main( void )
          printf( "\n" );
 
          time( &startTimeInSec );
+         tempTimeInSec = startTimeInSec;
 
-         while ( erasesInProgress > 0 )
+         while ( ( erasesInProgress > 0 ) || ( overwritesInProgress > 0 ) )
          {
             // Check timeout condition
             time( &currentTimeInSec );
             if ( ( currentTimeInSec - startTimeInSec ) > ERASE_TIMEOUT_IN_SECONDS ) {
                // Timeout occurred!
-               printf( "Program timeout of %d hours occurred!!!\n", ( ERASE_TIMEOUT_IN_SECONDS / 3600 ) );
+               EndProgressLine();
+               printf( "Program timeout of %ld hours occurred!!!\n", ( ERASE_TIMEOUT_IN_SECONDS / 3600L ) );
+
+               // Report each overwrite in progress, no command is in flight
+               for ( eachDevice = 0; eachDevice < MAX_STORAGE_DEVICES; eachDevice++ ) {
+                  if ( wActiveDevices[ eachDevice ] == ACTIVE_OVERWRITE ) {
+                     char lbaString[ LBA48_STRING_SIZE ];
+
+                     printf( "Device %d stopped overwriting at LBA %s.\n", ( eachDevice + 1 ),
+                             FormatLBA48( lbaString, wOverwriteJobs[ eachDevice ].lbaHigh, wOverwriteJobs[ eachDevice ].lba ) );
+                  }
+               }
 
                // Report on each device in progress
                for ( eachDevice = 0; eachDevice < MAX_STORAGE_DEVICES; eachDevice++ ) {
-                  if ( wActiveDevices[ eachDevice ] != 0 ) {
+                  if ( wActiveDevices[ eachDevice ] == ACTIVE_ERASE ) {
                      int returnStatus;
                      
                      printf( "Device %d is still processing erase command.\n", ( eachDevice + 1 ) );
                      printf( "Resetting device..." );
+                     SetActiveDevice( eachDevice );
                      SoftwareReset(); returnStatus = ukReturnValue1;
                      if ( returnStatus == ERROR ) {
                         printf( "Success" );
@@ -278,42 +485,61 @@ int main( void )
                break;
             }
 
-            // Delay between checks
-            time( &tempTimeInSec );
+            // Overwrite the next slice of each device
+            devicesOverwritten = 0;
+            if ( overwritesInProgress > 0 ) {
+               devicesOverwritten = OverwriteSlice( wActiveDevices, &overwritesInProgress, startTimeInSec );
+            }
+
+            if ( erasesInProgress == 0 ) {
+               continue;
+            }
+
+            // Delay between checks, overwriting in the meantime if possible
             time( &currentTimeInSec );
-            while ( ( currentTimeInSec - tempTimeInSec ) < TIME_DELAY_BETWEEN_CHECKS_IN_SECONDS ) {
-               time( &currentTimeInSec );
+            if ( devicesOverwritten == 0 ) {
+               while ( ( currentTimeInSec - tempTimeInSec ) < TIME_DELAY_BETWEEN_CHECKS_IN_SECONDS ) {
+                  time( &currentTimeInSec );
+               }
             }
+            if ( ( currentTimeInSec - tempTimeInSec ) < TIME_DELAY_BETWEEN_CHECKS_IN_SECONDS ) {
+               continue;
+            }
+            tempTimeInSec = currentTimeInSec;
 
             // Check each device in progress
             for ( eachDevice = 0; eachDevice < MAX_STORAGE_DEVICES; eachDevice++ ) {
-               if ( wActiveDevices[ eachDevice ] != 0 ) {
+               if ( wActiveDevices[ eachDevice ] == ACTIVE_ERASE ) {
                   // Erase started on this device
 
-                  // Select drive, DOES NOT send data to drive!
-                  SetActiveDevice( eachDevice );
-
-                  eraseInProgress = ATAIOREG_CheckForCommandInProgress();
+                  // Reads the status once, the context knows the device's ports
+                  eraseInProgress = ! asy_poll( &wEraseCmds[ eachDevice ] );
 
                   if ( eraseInProgress == 0 ) {
                      // Erase completed!
                      char* pTimeStr;
 
+                     asy_complete( &wEraseCmds[ eachDevice ] );
+
+                     // Select drive for the model string, DOES NOT send data to drive!
+                     SetActiveDevice( eachDevice );
+
                      TOOLS_GetTime( &pTimeStr );
+                     EndProgressLine();
 
                      printf( "Erase completed at %s on device %d [", pTimeStr, ( eachDevice + 1 ) );
                      PrintModelString();
                      printf( "]!\n" );
 
-                     printf( "Completion status: %02X%02Xh...", reg_cmd_info.as2, reg_cmd_info.er2 );
-                     if ( reg_cmd_info.er2 == 0 ) {
+                     printf( "Completion status: %02X%02Xh...", wEraseCmds[ eachDevice ].info.as2, wEraseCmds[ eachDevice ].info.er2 );
+                     if ( wEraseCmds[ eachDevice ].info.er2 == 0 ) {
                         printf( "Success\n" );
                      } else {
                         printf( "ERROR!\n" );
                      }
 
                      fflush( stdout );
-                     wActiveDevices[ eachDevice ] = 0;
+                     wActiveDevices[ eachDevice ] = ACTIVE_NONE;
                      erasesInProgress--;
                   }
                }
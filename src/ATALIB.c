@@ -103,7 +103,8 @@ unsigned long ugReturnValue4 = -1;
 unsigned long ugReturnValue5 = -1;
 
 // Arrarys
-unsigned char buffer[BUFFER_SIZE];   // The global data buffer for ATALIB.c
+static unsigned char wcStaticBuffer[BUFFER_SIZE];   // The global data buffer unless it crosses a 64KB boundary
+unsigned char far* buffer = wcStaticBuffer;          // The global data buffer for ATALIB.c (BUFFER_SIZE bytes)
 unsigned char wcMaxLBA[8];           // Holds the max LBA from different ATALIB.c functions
 char wcPrintBuffer[NUMBER_OF_CHARACTERS_IN_DOS_LINE+1];   // Allocates memory for ATALIB.c printing
 char wcDriveString[3];
@@ -113,16 +114,79 @@ char wcUserReply[5];
 
 static struct StorageDevice_t wtStorageDevices[ MAX_STORAGE_DEVICES ];
 
+// Streamed PIO command block handler (see StreamSectorsInLBA48())
+static StreamBlockFn_t upStreamBlockFn;
+static void* upStreamContext;
+
+// Surface scan state (see SurfaceScan())
+static struct ScanResult_t* upScanResult;
+static FILE* upScanMapFile;
+static int ukScanUseDMA;
+static int ukScanLBA48;
+static unsigned long ugScanBadLBA;             // bad sectors not in the map yet
+static unsigned long ugScanBadLBAHigh;
+static unsigned long ugScanBadCount;
+static unsigned char ucScanBadStatus;
+static unsigned char ucScanBadError;
+static unsigned char ucScanStatus;             // status and error of the last failed command
+static unsigned char ucScanError;
+
 // Pointers
 FILE* upLog;
 char* upPrintString = wcPrintBuffer;
 unsigned char far* upBufferPtr;
+static unsigned char far* upLargeDmaBuffer;   // LARGE PRD list and I/O area, NULL = not allocated
+#if defined( __386__ )
+static unsigned int ukFlatDmaSeg;              // 32-bit build: physically contiguous DMA buffer
+static unsigned int ukFlatDmaOff;
+static long lgFlatDmaSize;                     // 0 = not allocated
+#else
+static unsigned char far* upSchedDmaArea[ ASY_MAX_DMA ];  // DMA data areas of RunScheduledJobs(), NULL = not allocated
+#endif
 
 //-----------------------------[LOCAL DECLARATIONS]-----------------------------
 
 
 //------------------------------[ATALIB FUNCTIONS]------------------------------
 
+#if defined( __386__ )
+//------------------------------------------------------------------------------
+// Description: 32-bit build only. Runs a PCI DMA command through the flat DMA
+//              buffer. The global buffer isn't physically contiguous in the
+//              flat model, so its contents are copied to the DMA buffer before
+//              the command and back afterwards (up to BUFFER_SIZE bytes).
+//
+// Input:  lba48        - ON = dma_pci_lba48(); OFF = dma_pci_lba28()
+//         cmd          - command register
+//         feat         - features register
+//         secCnt       - sector count
+//         lbaLow       - lba address bits 0-31
+//         lbaHigh      - lba address bits 32-47
+//         numSect      - number of sectors to transfer
+//
+// Output: dma_pci_lbaXX() return value
+//------------------------------------------------------------------------------
+static int FlatPCIDMACommand( int lba48, int cmd, unsigned int feat, unsigned int secCnt, unsigned long lbaLow, unsigned long lbaHigh, long numSect )
+{
+   int returnStatus;
+   unsigned char far* pDmaBuffer = (unsigned char far *) ATA_PTR( ATA_LINEAR( ukFlatDmaSeg, ukFlatDmaOff ) );
+
+   memcpy( pDmaBuffer, buffer, BUFFER_SIZE );
+   reg_buffer_size = lgFlatDmaSize;
+
+   if ( lba48 == ON ) {
+      returnStatus = dma_pci_lba48( ukDevicePosition, cmd, feat, secCnt, lbaHigh, lbaLow, ukFlatDmaSeg, ukFlatDmaOff, numSect );
+   } else {
+      returnStatus = dma_pci_lba28( ukDevicePosition, cmd, feat, secCnt, lbaLow, ukFlatDmaSeg, ukFlatDmaOff, numSect );
+   }
+
+   reg_buffer_size = BUFFER_SIZE;
+   memcpy( buffer, pDmaBuffer, BUFFER_SIZE );
+
+   return ( returnStatus );
+}
+#endif
+
 //------------------------------------------------------------------------------
 // Description: Sends a non-data command.
 //
@@ -153,7 +217,7 @@ int SendNonDataCommand( int cmd, unsigned int feat, unsigned int secCnt, unsigne
 int SendLBA28DataInCommand( int cmd, unsigned int feat, unsigned int secCnt, unsigned long lba )
 {
    // Clear the buffer so there's no remnant data in buffer before reading
-   memset( buffer, 0, sizeof( buffer ) );
+   memset( buffer, 0, BUFFER_SIZE );
 
    return ( reg_pio_data_in_lba28( ukDevicePosition, cmd, feat, secCnt, lba, FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ), secCnt, ukMulti ) );
 }
@@ -172,7 +236,7 @@ int SendLBA28DataInCommand( int cmd, unsigned int feat, unsigned int secCnt, uns
 int SendLBA48DataInCommand( int cmd, unsigned int feat, unsigned int secCnt, unsigned long lbaLow, unsigned long lbaHigh )
 {
    // Clear the buffer so there's no remnant data in buffer before reading
-   memset( buffer, 0, sizeof( buffer ) );
+   memset( buffer, 0, BUFFER_SIZE );
 
    return ( reg_pio_data_in_lba48( ukDevicePosition, cmd, feat, secCnt, lbaHigh, lbaLow, FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ), secCnt, ukMulti ) );
 }
@@ -222,6 +286,10 @@ int SendLBA48DataOutCommand( int cmd, unsigned int feat, unsigned int secCnt, un
 int SendLBA48DMACommand( int cmd, unsigned int feat, unsigned int secCnt, unsigned long lbaLow, unsigned long lbaHigh )
 {
    int returnStatus;
+   long numSect;
+
+   // Sector count 0 is 65536 sectors
+   numSect = ( secCnt != 0 ) ? (long) secCnt : LARGE_DMA_MAX_SECTORS;
 
    if ( ( pio_bmide_base_addr == INVALID_VALUE ) && ( ( pio_base_addr1 == LEGACY_PRIMARY_BASEPORT ) || ( pio_base_addr1 == LEGACY_SECONDARY_BASEPORT ) ) ) {
       returnStatus = EnableISADMA();
@@ -237,7 +305,24 @@ int SendLBA48DMACommand( int cmd, unsigned int feat, unsigned int secCnt, unsign
       }
 
       if ( returnStatus == NO_ERROR ) {
-         dma_pci_lba48( ukDevicePosition, cmd, feat, secCnt, lbaHigh, lbaLow, FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ), secCnt );
+         // Transfers that don't fit the global buffer use the LARGE PRD list,
+         // the data then goes to the 64KB area of the large DMA buffer
+#if defined( __386__ )
+         // 32-bit build: the flat DMA buffer takes the whole transfer when
+         // it is big enough, no LARGE PRD list needed
+         if ( ( numSect * 512L ) <= lgFlatDmaSize ) {
+            returnStatus = FlatPCIDMACommand( ON, cmd, feat, secCnt, lbaLow, lbaHigh, numSect );
+         } else
+#endif
+         {
+            if ( ( ( numSect * 512L ) > BUFFER_SIZE ) && ( numSect <= dma_pci_largeMaxS ) ) {
+               dma_pci_prd_type = PRD_TYPE_LARGE;
+            }
+
+            returnStatus = dma_pci_lba48( ukDevicePosition, cmd, feat, secCnt, lbaHigh, lbaLow, FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ), numSect );
+         }
+         returnStatus = ( returnStatus == 0 ) ? NO_ERROR : ERROR;
+         dma_pci_prd_type = PRD_TYPE_SIMPLE;
 
          if ( ( pio_base_addr1 == LEGACY_PRIMARY_BASEPORT ) || ( pio_base_addr1 == LEGACY_SECONDARY_BASEPORT ) ) {
             DisableInterrupt();
@@ -276,6 +361,11 @@ int SendLBA28DMACommand( int cmd, unsigned int feat, unsigned int secCnt, unsign
       }
 
       if ( returnStatus == NO_ERROR ) {
+#if defined( __386__ )
+         if ( lgFlatDmaSize != 0 ) {
+            FlatPCIDMACommand( OFF, cmd, feat, secCnt, lba, 0L, ( secCnt != 0 ) ? (long) secCnt : 256L );
+         } else
+#endif
          dma_pci_lba28( ukDevicePosition, cmd, feat, secCnt, lba, FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ), secCnt );
 
          if ( ( pio_base_addr1 == LEGACY_PRIMARY_BASEPORT ) || ( pio_base_addr1 == LEGACY_SECONDARY_BASEPORT ) ) {
@@ -287,6 +377,39 @@ int SendLBA28DMACommand( int cmd, unsigned int feat, unsigned int secCnt, unsign
    return ( returnStatus );
 }
 
+//------------------------------------------------------------------------------
+// Description: Sets the SECURITY ERASE UNIT time out profile from the IDENTIFY
+//              DEVICE data: 2x the longer of the normal (word 89) and enhanced
+//              (word 90) erase times. If bit 15 is set the time is in bits
+//              14:0, else in bits 7:0, in units of 2 minutes. A device that
+//              gives no time gets DEFAULT_ERASE_TIME_IN_MINUTES.
+//
+// Input:  *buffer        - 512-byte ID data
+//
+// Output: None
+//------------------------------------------------------------------------------
+static void SetEraseTimeoutFromIdentify( void )
+{
+   unsigned short int kWord;
+   long eraseTimeInMin, enhancedEraseTimeInMin;
+
+   kWord = *(unsigned short int far *)( buffer + ( 89 * 2 ) );
+   eraseTimeInMin = 2L * ( ( kWord & 0x8000 ) ? ( kWord & 0x7FFF ) : ( kWord & 0x00FF ) );
+
+   kWord = *(unsigned short int far *)( buffer + ( 90 * 2 ) );
+   enhancedEraseTimeInMin = 2L * ( ( kWord & 0x8000 ) ? ( kWord & 0x7FFF ) : ( kWord & 0x00FF ) );
+
+   if ( enhancedEraseTimeInMin > eraseTimeInMin ) {
+      eraseTimeInMin = enhancedEraseTimeInMin;
+   }
+
+   if ( eraseTimeInMin == 0 ) {
+      eraseTimeInMin = DEFAULT_ERASE_TIME_IN_MINUTES;
+   }
+
+   tmr_set_cmd_code_timeout( CMD_SECURITY_ERASE_UNIT, ( 2L * eraseTimeInMin * 60L ) );
+}
+
 //------------------------------------------------------------------------------
 // Description: Issue an Identify Device command.
 //
@@ -302,7 +425,7 @@ void IdentifyDevice()
    int returnStatus;
 
    // Clear the buffer
-   memset (buffer, 0, sizeof (buffer));
+   memset (buffer, 0, BUFFER_SIZE);
 
    if (ukQuietMode == OFF)
    {
@@ -319,6 +442,11 @@ void IdentifyDevice()
       1, 0
       );
 
+   // Commands get their time outs from the ID data where ATA defines one
+   if ( returnStatus == 0 ) {
+      SetEraseTimeoutFromIdentify();
+   }
+
    ukReturnValue1 = returnStatus;
    return;
 } // End IdentifyDevice
@@ -338,7 +466,7 @@ void DeviceConfigurationIdentify()
    int returnStatus;
 
    // Clear the buffer
-   memset( buffer, 0, sizeof( buffer ) );
+   memset( buffer, 0, BUFFER_SIZE );
 
    if (ukQuietMode == OFF)
    {
@@ -370,12 +498,63 @@ void DeviceConfigurationIdentify()
 //------------------------------------------------------------------------------
 void ATALIB_Initialize()
 {
+#if ! defined( __386__ )
+   unsigned long linAddr, clearOffset;
+   unsigned int seg;
+   unsigned int off;
+
+   // The global buffer must not cross a 64KB physical boundary, then every
+   // DMA command needs one ISA DMA channel program or the fewest PRDs. Where
+   // the static buffer crosses one, use an aligned buffer instead. (The
+   // 32-bit build moves PCI DMA data through its own contiguous buffer.)
+   linAddr = ATA_LINEAR( FP_SEG( wcStaticBuffer ), FP_OFF( wcStaticBuffer ) );
+   if ( ( linAddr >> 16 ) != ( ( linAddr + BUFFER_SIZE - 1 ) >> 16 ) ) {
+      if ( dma_alloc_aligned_buf( BUFFER_SIZE, &seg, &off ) == 0 ) {
+         buffer = (unsigned char far *) ATA_PTR( ATA_LINEAR( seg, off ) );
+      }
+   }
+#endif
+
    // Initialize far pointer to the I/O buffer
    upBufferPtr = (unsigned char far *) buffer;
 
    // Tell ATADRVR how big the buffer is
    reg_buffer_size = BUFFER_SIZE;
 
+   // Buffer for READ/WRITE DMA EXT transfers larger than the global buffer.
+   // It must hold a 64KB aligned 64KB area plus a 4KB PRD list, so allow for
+   // the worst case alignment. Without it DMA stays limited to BUFFER_SIZE.
+#if defined( __386__ )
+   // 32-bit build: one physically contiguous buffer takes all PCI DMA
+   // transfers, try 32MB first and halve it until the allocation works.
+   upLargeDmaBuffer = NULL;
+   for ( lgFlatDmaSize = FLAT_DMA_BUFFER_SIZE; lgFlatDmaSize >= FLAT_DMA_MIN_BUFFER_SIZE; lgFlatDmaSize >>= 1 ) {
+      if ( dma_pci_alloc_buf( lgFlatDmaSize, &ukFlatDmaSeg, &ukFlatDmaOff ) == 0 ) {
+         break;
+      }
+   }
+   if ( lgFlatDmaSize < FLAT_DMA_MIN_BUFFER_SIZE ) {
+      lgFlatDmaSize = 0;
+   }
+
+   // Large WRITE DMA EXT would otherwise send leftover memory to the disk
+   if ( lgFlatDmaSize != 0 ) {
+      memset( ATA_PTR( ATA_LINEAR( ukFlatDmaSeg, ukFlatDmaOff ) ), 0, lgFlatDmaSize );
+   }
+#else
+   upLargeDmaBuffer = (unsigned char far *) halloc( LARGE_DMA_BUFFER_SIZE, 1 );
+
+   // Large WRITE DMA EXT would otherwise send leftover memory to the disk,
+   // cleared 32KB at a time as the buffer is larger than a segment
+   if ( upLargeDmaBuffer != NULL ) {
+      linAddr = ATA_LINEAR( FP_SEG( upLargeDmaBuffer ), FP_OFF( upLargeDmaBuffer ) );
+      for ( clearOffset = 0L; clearOffset < LARGE_DMA_BUFFER_SIZE; clearOffset += 32768L ) {
+         memset( ATA_PTR( linAddr + clearOffset ), 0,
+                 (unsigned int) ( ( ( LARGE_DMA_BUFFER_SIZE - clearOffset ) < 32768L ) ? ( LARGE_DMA_BUFFER_SIZE - clearOffset ) : 32768L ) );
+      }
+   }
+#endif
+
    // Allocate memory for the global print string
    upPrintString = (char *)malloc( NUMBER_OF_CHARACTERS_IN_DOS_LINE + 1 );
 
@@ -391,7 +570,40 @@ void ATALIB_Initialize()
 //------------------------------------------------------------------------------
 void ATALIB_CleanUp()
 {
-   DisableInterrupt();
+#if ! defined( __386__ )
+   int area;
+
+#endif
+   // Interrupt mode of every channel
+   int_disable_all();
+
+   // Write the rest of the binary command trace log
+   trc_bin_close();
+
+#if defined( __386__ )
+   if ( lgFlatDmaSize != 0 ) {
+      dma_pci_free_buf();
+      lgFlatDmaSize = 0;
+   }
+#else
+   if ( upLargeDmaBuffer != NULL ) {
+      hfree( upLargeDmaBuffer );
+      upLargeDmaBuffer = NULL;
+   }
+   for ( area = 0; area < ASY_MAX_DMA; area++ ) {
+      if ( upSchedDmaArea[ area ] != NULL ) {
+         dma_free_aligned_buf( FP_SEG( upSchedDmaArea[ area ] ), FP_OFF( upSchedDmaArea[ area ] ) );
+         upSchedDmaArea[ area ] = NULL;
+      }
+   }
+#endif
+
+#if ! defined( __386__ )
+   if ( buffer != wcStaticBuffer ) {
+      dma_free_aligned_buf( FP_SEG( buffer ), FP_OFF( buffer ) );
+      buffer = upBufferPtr = wcStaticBuffer;
+   }
+#endif
 }
 
 //------------------------------------------------------------------------------
@@ -1053,6 +1265,49 @@ void GetMaxLBAFromDCO()
    return;
 } // End GetMaxLBAFromDCO
 
+//------------------------------------------------------------------------------
+// Description: Formats a 48-bit LBA (or sector count) as a decimal number. The
+//              LBA is divided by 10000 in 16-bit pieces, so no 64-bit integer
+//              is needed.
+//
+// Input:  pString      - at least LBA48_STRING_SIZE characters
+//         lbaHigh      - LBA bits 47:32
+//         lbaLow       - LBA bits 31:0
+//
+// Output: pString
+//------------------------------------------------------------------------------
+char* FormatLBA48( char* pString, unsigned long lbaHigh, unsigned long lbaLow )
+{
+   unsigned int piece[ 3 ];
+   unsigned int digits[ 4 ];
+   unsigned long remainder;
+   int eachPiece, numDigits;
+   char* pNext;
+
+   piece[ 0 ] = (unsigned int) ( lbaHigh & 0xFFFFL );
+   piece[ 1 ] = (unsigned int) ( lbaLow >> 16 );
+   piece[ 2 ] = (unsigned int) ( lbaLow & 0xFFFFL );
+
+   // Four decimal digits at a time, least significant first
+   numDigits = 0;
+   do {
+      remainder = 0L;
+      for ( eachPiece = 0; eachPiece < 3; eachPiece++ ) {
+         remainder = ( remainder << 16 ) | piece[ eachPiece ];
+         piece[ eachPiece ] = (unsigned int) ( remainder / 10000L );
+         remainder %= 10000L;
+      }
+      digits[ numDigits++ ] = (unsigned int) remainder;
+   } while ( ( piece[ 0 ] | piece[ 1 ] | piece[ 2 ] ) != 0 );
+
+   pNext = pString + sprintf( pString, "%u", digits[ --numDigits ] );
+   while ( numDigits > 0 ) {
+      pNext += sprintf( pNext, "%04u", digits[ --numDigits ] );
+   }
+
+   return ( pString );
+}
+
 //------------------------------------------------------------------------------
 // Description: Checks if a host protected area has been set by comparing the
 //              max LBA from identify device and the max LBA from read native
@@ -1155,11 +1410,12 @@ void ReadNativeMaxAddress( int kCommandType )
 //                          OFF = Non-EXT command
 //         kVolatility    - 1   = Non-volatile
 //                          0   = Volatile
-//         gLBA           - LBA to set
+//         gLBA           - LBA to set (bits 31:0)
+//         gLBAHigh       - LBA to set (bits 47:32), EXT command only
 //
 // Output: ukReturnValue1 - function status, ERROR/NO ERROR
 //------------------------------------------------------------------------------
-void SetMaxAddress( int kCommandType, int kVolatility, unsigned long gLBA )
+void SetMaxAddress( int kCommandType, int kVolatility, unsigned long gLBA, unsigned long gLBAHigh )
 {
    int returnStatus;
 
@@ -1179,7 +1435,7 @@ void SetMaxAddress( int kCommandType, int kVolatility, unsigned long gLBA )
          returnStatus = reg_non_data_lba48 (
             ukDevicePosition, 0x37,
             0, kVolatility,
-            0L, gLBA
+            gLBAHigh, gLBA
             );
          break;
 
@@ -1229,7 +1485,7 @@ void SetHPA( int kCommandType, int kVolatility, unsigned long gLBA )
 
    if ( returnStatus == NO_ERROR )
    {
-      SetMaxAddress( kCommandType, kVolatility, gLBA );
+      SetMaxAddress( kCommandType, kVolatility, gLBA, 0L );
       returnStatus = ukReturnValue1;
    }
 
@@ -1258,15 +1514,15 @@ void RemoveHPA ()
 
    // 28-bit volatile
    ReadNativeMaxAddress (LBA28_MODE);
-   SetMaxAddress (LBA28_MODE, HPA_VOLATILE, reg_cmd_info.lbaLow2);
+   SetMaxAddress (LBA28_MODE, HPA_VOLATILE, reg_cmd_info.lbaLow2, 0L);
 
    // 48-bit volatile
    ReadNativeMaxAddress (LBA48_MODE);
-   SetMaxAddress (LBA48_MODE, HPA_VOLATILE, reg_cmd_info.lbaLow2);
+   SetMaxAddress (LBA48_MODE, HPA_VOLATILE, reg_cmd_info.lbaLow2, reg_cmd_info.lbaHigh2);
 
    // 28-bit non-volatile
    ReadNativeMaxAddress (LBA28_MODE);
-   SetMaxAddress (LBA28_MODE, HPA_NON_VOLATILE, reg_cmd_info.lbaLow2);
+   SetMaxAddress (LBA28_MODE, HPA_NON_VOLATILE, reg_cmd_info.lbaLow2, 0L);
    returnStatus = ukReturnValue1;
 
    // No 28-bit HPA.  Try to reset 48-bit HPA with Set Max EXT
@@ -1277,7 +1533,7 @@ void RemoveHPA ()
       // Read Native Max Address EXT
       // Non-volatile Set Max Address EXT
       ReadNativeMaxAddress (LBA48_MODE);
-      SetMaxAddress (LBA48_MODE, HPA_NON_VOLATILE, reg_cmd_info.lbaLow2);
+      SetMaxAddress (LBA48_MODE, HPA_NON_VOLATILE, reg_cmd_info.lbaLow2, reg_cmd_info.lbaHigh2);
    }
 
    ukReturnValue1 = returnStatus;
@@ -1665,7 +1921,7 @@ void SecurityUnlockPassword (const char* wcPasswordString, int kPasswordType)
    int kSecurityLockedFlag, returnStatus;
 
    // Clear the buffer
-   memset( buffer, 0, sizeof( buffer ) );
+   memset( buffer, 0, BUFFER_SIZE );
 
    if ( kPasswordType == USER_PASSWORD ) {
       *buffer = USER_PASSWORD;         // Use user Password
@@ -1718,7 +1974,7 @@ void SecurityDisablePassword( const char* wcPasswordString, int kPasswordType )
    int kSecurityEnabledFlag, returnStatus;
 
    // Clear the buffer
-   memset( buffer, 0, sizeof( buffer ) );
+   memset( buffer, 0, BUFFER_SIZE );
 
    if ( kPasswordType == USER_PASSWORD ) {
       *buffer = USER_PASSWORD;      // Use user Password
@@ -1771,7 +2027,7 @@ void SecuritySetPassword (const char* wcPasswordString, int kPasswordType, int k
    int returnStatus, kSecurityEnabledFlag;
 
    // Clear the buffer
-   memset( buffer, 0, sizeof( buffer ) );
+   memset( buffer, 0, BUFFER_SIZE );
 
    if (kPasswordType == USER_PASSWORD) {
       *buffer = USER_PASSWORD;                  // Use User Password
@@ -1861,7 +2117,7 @@ void SecureErase( const char* wcPasswordString, int kPasswordType, int kEraseTyp
    unsigned int kWord0;
 
    // Clear the buffer
-   memset( buffer, 0, sizeof( buffer ) );
+   memset( buffer, 0, BUFFER_SIZE );
 
    // Copy the erase options to word 0 of the buffer
    kWord0 =( kPasswordType | kEraseType );
@@ -1895,6 +2151,53 @@ void SecureErase( const char* wcPasswordString, int kPasswordType, int kEraseTyp
    ukReturnValue1 = returnStatus;
    return;
 } // End SecureErase
+
+//------------------------------------------------------------------------------
+// Description: Perform a security erase prepare, then start a normal or
+//              enhanced secure erase without waiting for it to finish. The
+//              password block is sent before returning. Use asy_poll() and
+//              asy_complete() on pEraseCmd to find out when the erase is done.
+//
+// Input:  *pEraseCmd           - Command context for the erase
+//         *wcPasswordString    - String containing the password to use
+//         kPasswordType        - Either user or master password
+//         kEraseType           - Either normal or enhanced
+//
+// Output: ukReturnValue1       - 0 = Secure Erase started
+//                                1 = Secure Erase not started
+//------------------------------------------------------------------------------
+void SecureEraseStart( struct ASY_CMD* pEraseCmd, const char* wcPasswordString, int kPasswordType, int kEraseType )
+{
+   int returnStatus;
+
+   // Clear the buffer
+   memset( buffer, 0, BUFFER_SIZE );
+
+   // Copy the erase options to word 0 and the password to word 1
+   *buffer = ( kPasswordType | kEraseType );
+   strcpy( ( buffer + 2 ), wcPasswordString );
+
+   // Security erase prepare
+   reg_non_data_lba28( ukDevicePosition, CMD_SECURITY_ERASE_PREPARE, 0, 0, 0L );
+
+   // Secure erase command
+   asy_setup_lba28( pEraseCmd, ASY_PROT_PDO, ukDevicePosition, CMD_SECURITY_ERASE_UNIT,
+                    0, 0, 0L, FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ), 1L, 0 );
+   returnStatus = asy_submit( pEraseCmd );
+
+   // Send the password block now, the buffer is reused by the next command
+   while ( ( returnStatus == 0 ) && ( pEraseCmd->numSect > 0 ) ) {
+      if ( asy_poll( pEraseCmd ) ) {
+         returnStatus = ( pEraseCmd->numSect > 0 );
+      }
+   }
+   if ( returnStatus != 0 ) {
+      asy_complete( pEraseCmd );
+   }
+
+   ukReturnValue1 = returnStatus;
+   return;
+} // End SecureEraseStart
 /*
 void SetHighestUDMAMode ()
 {
@@ -1910,6 +2213,67 @@ void SetUDMAMode (kUDMAMode)
    kUDMAMode
 }
 */
+//------------------------------------------------------------------------------
+// Description: Reads the maximum sectors per DRQ block from IDENTIFY DEVICE
+//              word 47 and sets the active device to it with SET MULTIPLE
+//              MODE, so the PIO read/write helpers can use READ/WRITE MULTIPLE.
+// Note:        Sends commands to the device, see UseMultipleMode().
+//
+// Input:  None
+//
+// Output: Sectors per DRQ block now set on the device, 1 = multiple mode
+//         not supported or SET MULTIPLE MODE failed
+//------------------------------------------------------------------------------
+static unsigned int ConfigureMultipleMode( void )
+{
+   static unsigned char wcIdData[ 512 ];
+   unsigned int maxMulti;
+
+   if ( reg_pio_data_in_lba28( ukDevicePosition, CMD_IDENTIFY_DEVICE,
+                               0, 0, 0L,
+                               FP_SEG( wcIdData ), FP_OFF( wcIdData ),
+                               1, 0 ) ) {
+      return ( 1 );
+   }
+
+   // Word 47 bits 7:0 - maximum sectors per DRQ block, 0 = not supported
+   maxMulti = wcIdData[ 47 * 2 ];
+
+   if ( maxMulti <= 1 ) {
+      return ( 1 );
+   }
+
+   if ( reg_non_data_lba28( ukDevicePosition, CMD_SET_MULTIPLE_MODE, 0, maxMulti, 0L ) ) {
+      return ( 1 );
+   }
+
+   return ( maxMulti );
+} // End ConfigureMultipleMode
+
+//------------------------------------------------------------------------------
+// Description: Sets multiple mode on the active device before its first READ/
+//              WRITE MULTIPLE (see ConfigureMultipleMode()) and loads ukMulti.
+//              Called by the helpers that pick READ/WRITE MULTIPLE themselves,
+//              so selecting or listing a device never changes its state.
+// Note:        Sends commands to the device the first time only, call with no
+//              command in flight.
+//
+// Input:  None
+//
+// Output: None (ukMulti - sectors per DRQ block, 0 = no multiple mode)
+//------------------------------------------------------------------------------
+static void UseMultipleMode( void )
+{
+   if ( ( uActiveDeviceIndex < 0 ) || ( uActiveDeviceIndex >= MAX_STORAGE_DEVICES ) ) {
+      return;
+   }
+
+   if ( wtStorageDevices[ uActiveDeviceIndex ].multiCnt == 0 ) {
+      wtStorageDevices[ uActiveDeviceIndex ].multiCnt = ConfigureMultipleMode();
+   }
+   ukMulti = ( wtStorageDevices[ uActiveDeviceIndex ].multiCnt > 1 ) ? wtStorageDevices[ uActiveDeviceIndex ].multiCnt : 0;
+} // End UseMultipleMode
+
 //------------------------------------------------------------------------------
 // Description: Write n number of sectors starting a specific CHS or LBA.
 //              Three write modes, LBA28, LBA48, CHS.  Contents in array
@@ -1941,9 +2305,11 @@ void WriteSectors (unsigned int kCylinder, unsigned int kHead, unsigned int kSec
    gLBALow               = gLBA;
    gLBAHigh              = IGNORE_VALUE;
 
+   UseMultipleMode();
+
    if (ukQuietMode == OFF)
    {
-      sprintf(upPrintString, "\n\nIssuing WRITE SECTOR(S)command");
+      sprintf(upPrintString, ( ukMulti > 1 ) ? "\n\nIssuing WRITE MULTIPLE command" : "\n\nIssuing WRITE SECTOR(S)command");
       PrintString (ukPrintOutput);
    }
 
@@ -1951,31 +2317,31 @@ void WriteSectors (unsigned int kCylinder, unsigned int kHead, unsigned int kSec
    {
       case (LBA28_MODE):
          returnStatus = reg_pio_data_out_lba28(
-            ukDevicePosition, CMD_WRITE_SECTORS,
+            ukDevicePosition, ( ukMulti > 1 ) ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTORS,
             kFeaturesRegister, gSectorCountRegister,
             gLBALow,
             FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ),
-            gNumberOfSectors, 0
+            gNumberOfSectors, ukMulti
             );
          break;
 
       case (LBA48_MODE):
          returnStatus = reg_pio_data_out_lba48(
-            ukDevicePosition, CMD_WRITE_SECTORS_EXT,
+            ukDevicePosition, ( ukMulti > 1 ) ? CMD_WRITE_MULTIPLE_EXT : CMD_WRITE_SECTORS_EXT,
             kFeaturesRegister, gSectorCountRegister,
             gLBAHigh, gLBALow,
             FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ),
-            gNumberOfSectors, 0
+            gNumberOfSectors, ukMulti
             );
          break;
 
       case (CHS_MODE):
          returnStatus = reg_pio_data_out_chs(
-            ukDevicePosition, CMD_WRITE_SECTORS,
+            ukDevicePosition, ( ukMulti > 1 ) ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTORS,
             kFeaturesRegister, gSectorCountRegister,
             kCylinder, kHead, kSector,
             FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ),
-            gNumberOfSectors, 0
+            gNumberOfSectors, ukMulti
             );
          break;
 
@@ -2078,6 +2444,10 @@ void WriteSectorsInCHS (unsigned int kCylinder, unsigned int kHead, unsigned int
 //              transfer in 48-bit mode if supported, else 28-bit mode.  The
 //              UDMA mode must be set before using this command (SetUDMAMode).
 //
+//              Up to 65536 sectors with READ/WRITE DMA EXT. Transfers larger
+//              than BUFFER_SIZE use the LARGE PRD list, which reuses one 64KB
+//              area for all the data, so the data is not in the global buffer.
+//
 // Input:  gLBA                 - LBA address to write
 //         kNumberOfSectors     - Number of sectors to write from starting LBA
 //
@@ -2090,6 +2460,11 @@ void WriteDMA( unsigned long lba, unsigned long numberOfSectors )
    unsigned int featuresRegister, sectorCountRegister;
    unsigned int lbaHigh;
 
+   if ( ( numberOfSectors < 1 ) || ( numberOfSectors > LARGE_DMA_MAX_SECTORS ) ) {
+      ukReturnValue1 = ERROR;
+      return;
+   }
+
    // Configure the registers for the write DMA command
    featuresRegister    = IGNORE_VALUE;
    sectorCountRegister = numberOfSectors;
@@ -2102,7 +2477,8 @@ void WriteDMA( unsigned long lba, unsigned long numberOfSectors )
 
    returnStatus = SendLBA48DMACommand( CMD_WRITE_DMA_EXT, featuresRegister, sectorCountRegister, lba, lbaHigh );
 
-   if ( returnStatus == ERROR ) {
+   // READ/WRITE DMA can't move more than 256 sectors
+   if ( ( returnStatus == ERROR ) && ( numberOfSectors <= 256 ) ) {
       if ( ukQuietMode == OFF ) {
          sprintf( upPrintString, "\n\nIssuing WRITE DMA command" );
          PrintString( ukPrintOutput );
@@ -2146,9 +2522,11 @@ void ReadSectors (unsigned int kCylinder, unsigned int kHead, unsigned int kSect
    gLBALow               = gLBA;
    gLBAHigh              = IGNORE_VALUE;
 
+   UseMultipleMode();
+
    if (ukQuietMode == OFF)
    {
-      sprintf(upPrintString, "\n\nIssuing READ SECTOR(S)command");
+      sprintf(upPrintString, ( ukMulti > 1 ) ? "\n\nIssuing READ MULTIPLE command" : "\n\nIssuing READ SECTOR(S)command");
       PrintString (ukPrintOutput);
    }
 
@@ -2156,31 +2534,31 @@ void ReadSectors (unsigned int kCylinder, unsigned int kHead, unsigned int kSect
    {
       case (LBA28_MODE):
          returnStatus = reg_pio_data_in_lba28(
-            ukDevicePosition, CMD_READ_SECTORS,
+            ukDevicePosition, ( ukMulti > 1 ) ? CMD_READ_MULTIPLE : CMD_READ_SECTORS,
             kFeaturesRegister, gSectorCountRegister,
             gLBALow,
             FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ),
-            gNumberOfSectors, 0
+            gNumberOfSectors, ukMulti
             );
          break;
 
       case (LBA48_MODE):
          returnStatus = reg_pio_data_in_lba48(
-            ukDevicePosition, CMD_READ_SECTORS_EXT,
+            ukDevicePosition, ( ukMulti > 1 ) ? CMD_READ_MULTIPLE_EXT : CMD_READ_SECTORS_EXT,
             kFeaturesRegister, gSectorCountRegister,
             gLBAHigh, gLBALow,
             FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ),
-            gNumberOfSectors, 0
+            gNumberOfSectors, ukMulti
             );
          break;
 
       case (CHS_MODE):
          returnStatus = reg_pio_data_in_chs(
-            ukDevicePosition, CMD_READ_SECTORS,
+            ukDevicePosition, ( ukMulti > 1 ) ? CMD_READ_MULTIPLE : CMD_READ_SECTORS,
             kFeaturesRegister, gSectorCountRegister,
             kCylinder, kHead, kSector,
             FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ),
-            gNumberOfSectors, 0
+            gNumberOfSectors, ukMulti
             );
          break;
 
@@ -2279,138 +2657,795 @@ void ReadSectorsInCHS (unsigned int kCylinder, unsigned int kHead, unsigned int
 } // End ReadSectorsInCHS
 
 //------------------------------------------------------------------------------
-// Description: Read n number of sectors starting a specific LBA using UDMA
-//              transfer in 48-bit mode if supported, else 28-bit mode.  The
-//              UDMA mode must be set before using this command (SetUDMAMode).
+// Description: DRQ block call back of a streamed PIO command. The driver
+//              rewinds the buffer to upBufferPtr for every DRQ block, so the
+//              block is always at the start of the global buffer.
 //
-// Input:  gLBA                 - LBA address to read
-//         kNumberOfSectors     - Number of sectors to read from starting LBA
+// Input:  pCmdInfo     - driver command info, drqPacketSize is the block size
 //
-// Output: ukReturnValue1       - NO_ERROR = Read successful
-//                                ERROR    = Read unsuccessful
+// Output: None
 //------------------------------------------------------------------------------
-void ReadDMA( unsigned long lba, unsigned long numberOfSectors )
+static void StreamDrqBlockCallBack( struct REG_CMD_INFO* pCmdInfo )
 {
-   int returnStatus;
-   unsigned int featuresRegister, sectorCountRegister;
-   unsigned long lbaHigh;
+   ( *upStreamBlockFn )( upBufferPtr, pCmdInfo->drqPacketSize, upStreamContext );
+}
 
-   // Configure the registers for the read DMA command
-   featuresRegister    = IGNORE_VALUE;
-   sectorCountRegister = numberOfSectors;
-   lbaHigh             = IGNORE_VALUE;
+//------------------------------------------------------------------------------
+// Description: Gives a command code time for a long transfer: its time out
+//              profile (or the global time out) plus the time to move
+//              numSectors at TIMEOUT_MIN_KB_PER_SECOND. Put the returned
+//              profile back with tmr_set_cmd_code_timeout() after the command.
+//
+// Input:  cmd          - command code
+//         numSectors   - sectors of the command
+//
+// Output: Previous time out profile of the command code, 0 = none
+//------------------------------------------------------------------------------
+static long ScaleCommandTimeout( unsigned char cmd, unsigned long numSectors )
+{
+   long prevTimeout, timeout;
 
-   if ( ukQuietMode == OFF ) {
-      sprintf( upPrintString, "\n\nIssuing READ DMA EXT command" );
-      PrintString( ukPrintOutput );
-   }
+   prevTimeout = tmr_get_cmd_code_timeout( cmd );
+   timeout = ( prevTimeout != 0 ) ? prevTimeout : tmr_get_command_timeout();
+   timeout += (long) ( ( numSectors / 2L ) / TIMEOUT_MIN_KB_PER_SECOND );
 
-   returnStatus = SendLBA48DMACommand( CMD_READ_DMA_EXT, featuresRegister, sectorCountRegister, lba, lbaHigh );
+   tmr_set_cmd_code_timeout( cmd, timeout );
 
-   if ( returnStatus == ERROR ) {
-      if ( ukQuietMode == OFF ) {
-         sprintf( upPrintString, "\n\nIssuing READ DMA command" );
-         PrintString( ukPrintOutput );
-      }
+   return ( prevTimeout );
+}
 
-      returnStatus = SendLBA28DMACommand( CMD_READ_DMA, featuresRegister, sectorCountRegister, lba );
+//------------------------------------------------------------------------------
+// Description: Returns the streaming command to use for the active device and
+//              sets its multiple count. READ/WRITE MULTIPLE EXT is used when a
+//              multiple count is set and its DRQ block fits in the buffer.
+//
+// Input:  multipleCmd  - READ/WRITE MULTIPLE EXT
+//         sectorsCmd   - READ/WRITE SECTORS EXT
+//         pMultiCnt    - multiple count for the driver
+//
+// Output: Command code
+//------------------------------------------------------------------------------
+static int StreamCommand( int multipleCmd, int sectorsCmd, int* pMultiCnt )
+{
+   UseMultipleMode();
+
+   if ( ( ukMulti > 1 ) && ( ( ukMulti * 512L ) <= BUFFER_SIZE ) ) {
+      *pMultiCnt = ukMulti;
+      return ( multipleCmd );
    }
 
-   ukReturnValue1 = returnStatus;
-   return;
-} // End ReadDMAEXT
+   *pMultiCnt = 0;
+   return ( sectorsCmd );
+}
 
 //------------------------------------------------------------------------------
-// Description: Issue a software reset command.
+// Description: Reads up to 65536 sectors with one LBA48 PIO command and hands
+//              each DRQ block to pConsumer as it arrives (checksum, file
+//              writer, pattern verifier...). The data never has to fit in the
+//              32KB global buffer, only one DRQ block at a time does.
 //
-// Input:  None
-// Output: None
+// Input:  lba          - first LBA
+//         numSectors   - 1 to STREAM_MAX_SECTORS sectors
+//         pConsumer    - called once per DRQ block
+//         pContext     - passed to pConsumer
+//
+// Output: NO_ERROR = successful; ERROR = unsuccessful
 //------------------------------------------------------------------------------
-void SoftwareReset()
+int StreamSectorsInLBA48( unsigned long lba, unsigned long numSectors, StreamBlockFn_t pConsumer, void* pContext )
 {
-   int returnStatus;
+   int cmd, multiCnt, returnStatus;
+   long prevTimeout;
 
-   if (ukQuietMode == OFF)
-   {
-      sprintf(upPrintString, "\n\nIssuing SOFTWARE RESET command");
-      PrintString (ukPrintOutput);
+   if ( ( numSectors < 1 ) || ( numSectors > STREAM_MAX_SECTORS ) || ( pConsumer == NULL ) ) {
+      return ( ERROR );
    }
 
-   // Issue a soft reset (SRST) command
-   returnStatus = reg_reset( 0, ukDevicePosition );
+   cmd = StreamCommand( CMD_READ_MULTIPLE_EXT, CMD_READ_SECTORS_EXT, &multiCnt );
+   prevTimeout = ScaleCommandTimeout( (unsigned char) cmd, numSectors );
 
-   ukReturnValue1 = returnStatus;
-} // End SoftwareReset
+   upStreamBlockFn = pConsumer;
+   upStreamContext = pContext;
+   reg_drq_block_call_back = &StreamDrqBlockCallBack;
+
+   // Sector count 0 is 65536 sectors. The driver clears the call back.
+   returnStatus = reg_pio_data_in_lba48( ukDevicePosition, cmd, 0, (unsigned int) ( numSectors & 0xFFFF ), 0L, lba,
+                                         FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ), numSectors, multiCnt );
+
+   tmr_set_cmd_code_timeout( (unsigned char) cmd, prevTimeout );
+   return ( returnStatus );
+}
 
 //------------------------------------------------------------------------------
-// Description: Issue a READ LOG EXT command to the given log address with
-//              a given transfer length.
+// Description: Writes up to 65536 sectors with one LBA48 PIO command.
+//              pProducer fills the global buffer with each DRQ block just
+//              before it is sent.
 //
-// Input:  gLogAddress                - The log address to read
-//         gTransferLengthInSectors   - Number of sectors to read
+// Input:  lba          - first LBA
+//         numSectors   - 1 to STREAM_MAX_SECTORS sectors
+//         pProducer    - called once per DRQ block
+//         pContext     - passed to pProducer
 //
-// Output: ukReturnValue1             - NO_ERROR = Command successful
-//                                      ERROR    = Command failed
-//         *buffer                    - buffer with the log data
+// Output: NO_ERROR = successful; ERROR = unsuccessful
 //------------------------------------------------------------------------------
-void ReadLogEXT (unsigned long gLogAddress, unsigned long gTransferLengthInSectors)
+int StreamSectorsOutLBA48( unsigned long lba, unsigned long numSectors, StreamBlockFn_t pProducer, void* pContext )
 {
-   int returnStatus;
-   unsigned int kFeaturesRegister;
-   unsigned long gSectorCountRegister, gLBAHigh, gLBALow, gNumberOfSectors;
-
-   // Set up the registers before sending the command
-   kFeaturesRegister    = IGNORE_VALUE;
-   gSectorCountRegister = gTransferLengthInSectors;   // Transfer length in sectors
-   gLBAHigh             = 0;                          // Byte offset 0
-   gLBALow              = gLogAddress;                // Log address
-   gNumberOfSectors     = gTransferLengthInSectors;   // Transfer length in sectors
+   int cmd, multiCnt, returnStatus;
+   long prevTimeout;
 
-   if (ukQuietMode == OFF)
-   {
-      sprintf(upPrintString, "\n\nIssuing READ LOG EXT command");
-      PrintString (ukPrintOutput);
+   if ( ( numSectors < 1 ) || ( numSectors > STREAM_MAX_SECTORS ) || ( pProducer == NULL ) ) {
+      return ( ERROR );
    }
 
-   // Read log EXT in LBA 48 mode
-   returnStatus = reg_pio_data_in_lba48(
-      ukDevicePosition, 0x2F,
-      kFeaturesRegister, gSectorCountRegister,
-      gLBAHigh, gLBALow,
-      FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ),
-      gNumberOfSectors, 0
-      );
+   cmd = StreamCommand( CMD_WRITE_MULTIPLE_EXT, CMD_WRITE_SECTORS_EXT, &multiCnt );
+   prevTimeout = ScaleCommandTimeout( (unsigned char) cmd, numSectors );
 
-   ukReturnValue1 = returnStatus;
-} // End ReadLogEXT
+   upStreamBlockFn = pProducer;
+   upStreamContext = pContext;
+   reg_drq_block_call_back = &StreamDrqBlockCallBack;
+
+   // Sector count 0 is 65536 sectors. The driver clears the call back.
+   returnStatus = reg_pio_data_out_lba48( ukDevicePosition, cmd, 0, (unsigned int) ( numSectors & 0xFFFF ), 0L, lba,
+                                          FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ), numSectors, multiCnt );
+
+   tmr_set_cmd_code_timeout( (unsigned char) cmd, prevTimeout );
+   return ( returnStatus );
+}
 
 //------------------------------------------------------------------------------
-// Description: Issue a WRITE LOG EXT command to the given log address with a
-//              given transfer length and write pattern in *buffer.
+// Description: Starts one READ DMA EXT of a pipelined DMA read in the
+//              background (see PipelinedReadDMA()).
 //
-// Input:  gLogAddress                - The log address to write
-//         gTransferLengthInSectors   - Number of sectors to write
-//         *buffer                    - Buffer with the pattern to be written
+// Input:  pCmd         - command context
+//         lba          - first LBA
+//         numSectors   - 1 to 65536 sectors, must fit in the buffer
+//         pBuffer      - DMA buffer
+//         useIntr      - TRUE = wait for the interrupt, FALSE = poll
 //
-// Output: ukReturnValue1             - NO_ERROR = Command successful
-//                                      ERROR    = Command failed
+// Output: None (a command that fails to start is done at once and
+//         asy_complete() returns its error)
 //------------------------------------------------------------------------------
-void WriteLogEXT (unsigned long gLogAddress, unsigned long gTransferLengthInSectors)
+static void PipeStartRead( struct ASY_CMD* pCmd, unsigned long lba, unsigned long numSectors, unsigned char far* pBuffer, int useIntr )
 {
-   int returnStatus;
-   unsigned int kFeaturesRegister;
-   unsigned long gSectorCountRegister, gLBAHigh, gLBALow, gNumberOfSectors;
+   asy_setup_lba48( pCmd, ASY_PROT_DMA, ukDevicePosition, CMD_READ_DMA_EXT, 0, (unsigned int) ( numSectors & 0xFFFF ), 0L, lba,
+                    FP_SEG( pBuffer ), FP_OFF( pBuffer ), numSectors, 0 );
+   pCmd->intr = useIntr;
+   asy_submit( pCmd );
+}
 
-   // Set up the registers before sending the command
-   kFeaturesRegister    = IGNORE_VALUE;
-   gSectorCountRegister = gTransferLengthInSectors;   // Transfer length in sectors
-   gLBAHigh             = 0;                          // Byte offset 0
-   gLBALow              = gLogAddress;                // Log address
-   gNumberOfSectors     = gTransferLengthInSectors;   // Transfer length in sectors
+//------------------------------------------------------------------------------
+// Description: Reads sectors with READ DMA EXT commands through two buffers so
+//              the drive keeps reading while the host works on the data. When
+//              the command for buffer A ends, the command for buffer B is
+//              started before pConsumer is called with buffer A, then the
+//              roles swap. Completion is signalled by the interrupt handler
+//              (int_intr_flag) when interrupts are enabled for the channel,
+//              else it is polled. Buffer A is the global buffer, buffer B is
+//              allocated for the call (in the 32-bit build both are halves of
+//              the flat DMA buffer). Needs PCI DMA (a BMIDE address).
+//
+// Input:  lba            - first LBA
+//         numSectors     - number of sectors to read
+//         sectorsPerCmd  - sectors per command, 1 to PIPE_MAX_SECTORS_PER_CMD
+//                          (32-bit build: up to half the flat DMA buffer)
+//         pConsumer      - called once per command with its data
+//         pContext       - passed to pConsumer
+//
+// Output: NO_ERROR = successful; ERROR = unsuccessful (ugReturnValue1 = LBA of
+//         the failed command)
+//------------------------------------------------------------------------------
+int PipelinedReadDMA( unsigned long lba, unsigned long numSectors, unsigned int sectorsPerCmd, StreamBlockFn_t pConsumer, void* pContext )
+{
+   static struct ASY_CMD wtPipeCmd[ 2 ];
+   unsigned char far* upPipeBuffer[ 2 ];
+   unsigned long cmdLBA[ 2 ], cmdSectors[ 2 ];
+   unsigned long nextLBA, sectorsLeft;
+   unsigned long maxSectors;
+   int returnStatus, useIntr, current;
+
+   if ( ( numSectors < 1 ) || ( sectorsPerCmd < 1 ) || ( pConsumer == NULL ) || ( pio_bmide_base_addr == INVALID_VALUE ) ) {
+      return ( ERROR );
+   }
 
-   if (ukQuietMode == OFF)
-   {
-      sprintf(upPrintString, "\n\nIssuing WRITE LOG EXT command");
+#if defined( __386__ )
+   maxSectors = ( lgFlatDmaSize / 2 ) / 512L;
+   upPipeBuffer[ 0 ] = (unsigned char far *) ATA_PTR( ATA_LINEAR( ukFlatDmaSeg, ukFlatDmaOff ) );
+   upPipeBuffer[ 1 ] = upPipeBuffer[ 0 ] + ( maxSectors * 512L );
+#else
+   maxSectors = PIPE_MAX_SECTORS_PER_CMD;
+   upPipeBuffer[ 0 ] = upBufferPtr;
+   upPipeBuffer[ 1 ] = (unsigned char far *) malloc( BUFFER_SIZE );
+   if ( upPipeBuffer[ 1 ] == NULL ) {
+      return ( ERROR );
+   }
+#endif
+
+   returnStatus = ( sectorsPerCmd <= maxSectors ) ? EnablePCIDMA() : ERROR;
+
+   if ( returnStatus == NO_ERROR ) {
+      // Use the interrupt only if our handler serves this channel
+      useIntr = ( EnableInterrupt() == NO_ERROR ) && int_use_intr_flag && ( int_bmide_addr == ( pio_bmide_base_addr + 2 ) );
+#if defined( __386__ )
+      reg_buffer_size = lgFlatDmaSize;
+#endif
+
+      // Start buffer A
+      current = 0;
+      nextLBA = lba;
+      sectorsLeft = numSectors;
+      cmdLBA[ 0 ] = nextLBA;
+      cmdSectors[ 0 ] = ( sectorsLeft < sectorsPerCmd ) ? sectorsLeft : sectorsPerCmd;
+      nextLBA += cmdSectors[ 0 ];
+      sectorsLeft -= cmdSectors[ 0 ];
+      PipeStartRead( &wtPipeCmd[ 0 ], cmdLBA[ 0 ], cmdSectors[ 0 ], upPipeBuffer[ 0 ], useIntr );
+
+      while ( returnStatus == NO_ERROR ) {
+         // Wait for the current buffer
+         if ( asy_complete( &wtPipeCmd[ current ] ) ) {
+            ugReturnValue1 = cmdLBA[ current ];
+            returnStatus = ERROR;
+            break;
+         }
+
+         // Nothing in flight until the other buffer starts, write the trace log if due
+         trc_bin_idle();
+
+         // Keep the drive busy: start the other buffer first...
+         if ( sectorsLeft > 0 ) {
+            cmdLBA[ current ^ 1 ] = nextLBA;
+            cmdSectors[ current ^ 1 ] = ( sectorsLeft < sectorsPerCmd ) ? sectorsLeft : sectorsPerCmd;
+            nextLBA += cmdSectors[ current ^ 1 ];
+            sectorsLeft -= cmdSectors[ current ^ 1 ];
+            PipeStartRead( &wtPipeCmd[ current ^ 1 ], cmdLBA[ current ^ 1 ], cmdSectors[ current ^ 1 ], upPipeBuffer[ current ^ 1 ], useIntr );
+         }
+
+         // ...then hand this one to the consumer
+         pConsumer( upPipeBuffer[ current ], (long) cmdSectors[ current ] * 512L, pContext );
+
+         if ( wtPipeCmd[ current ^ 1 ].state == ASY_STATE_IDLE ) {
+            break;                                          // nothing in flight, done
+         }
+         current ^= 1;
+      }
+
+#if defined( __386__ )
+      reg_buffer_size = BUFFER_SIZE;
+#endif
+      if ( ( pio_base_addr1 == LEGACY_PRIMARY_BASEPORT ) || ( pio_base_addr1 == LEGACY_SECONDARY_BASEPORT ) ) {
+         DisableInterrupt();
+      }
+   }
+
+#if ! defined( __386__ )
+   free( upPipeBuffer[ 1 ] );
+#endif
+
+   return ( returnStatus );
+}
+
+//------------------------------------------------------------------------------
+// Description: Issues one surface scan command, READ VERIFY SECTORS (EXT) or
+//              READ DMA (EXT) into the scratch DMA buffer. A command that ends
+//              with IDNF (past the end of the device, e.g. an HPA) stops the
+//              scan, a device that timed out is reset.
+//
+// Input:  lba          - first LBA (bits 31:0)
+//         lbaHigh      - first LBA (bits 47:32), 0 for the LBA28 commands
+//         numSectors   - sectors, 1 to the chunk size of the scan
+//         pUs          - gets the command time in us
+//
+// Output: NO_ERROR = successful; ERROR = unsuccessful
+//------------------------------------------------------------------------------
+static int ScanCommand( unsigned long lba, unsigned long lbaHigh, unsigned long numSectors, unsigned long* pUs )
+{
+   int returnStatus;
+   unsigned char cmd;
+   long prevTimeout;
+
+   upScanResult->commands++;
+
+   if ( ukScanUseDMA == ON ) {
+      cmd = ( ukScanLBA48 == ON ) ? CMD_READ_DMA_EXT : CMD_READ_DMA;
+   } else {
+      cmd = ( ukScanLBA48 == ON ) ? CMD_READ_VERIFY_SECTORS_EXT : CMD_READ_VERIFY_SECTORS;
+   }
+   prevTimeout = ScaleCommandTimeout( cmd, numSectors );
+
+   // Sector count 0 is 65536 (256 for LBA28) sectors
+   if ( ukScanUseDMA == ON ) {
+      if ( ukScanLBA48 == ON ) {
+         returnStatus = SendLBA48DMACommand( cmd, 0, (unsigned int) ( numSectors & 0xFFFF ), lba, lbaHigh );
+      } else {
+         returnStatus = SendLBA28DMACommand( cmd, 0, (unsigned int) numSectors, lba );
+      }
+   } else {
+      if ( ukScanLBA48 == ON ) {
+         returnStatus = reg_non_data_lba48( ukDevicePosition, cmd, 0, (unsigned int) ( numSectors & 0xFFFF ), lbaHigh, lba );
+      } else {
+         returnStatus = reg_non_data_lba28( ukDevicePosition, cmd, 0, (unsigned int) ( numSectors & 0xFF ), lba );
+      }
+   }
+
+   tmr_set_cmd_code_timeout( cmd, prevTimeout );
+
+   // The LBA28 DMA path does not return the command's result, use the driver's
+   if ( ( returnStatus != NO_ERROR ) || ( reg_cmd_info.ec != 0 ) ) {
+      returnStatus = ERROR;
+   }
+
+   *pUs = reg_cmd_info.endTime - reg_cmd_info.startTime;
+
+   if ( returnStatus == ERROR ) {
+      ucScanStatus = reg_cmd_info.st2;
+      ucScanError = reg_cmd_info.er2;
+      if ( reg_cmd_info.er2 & CB_ER_IDNF ) {
+         upScanResult->stopped = TRUE;
+      }
+      if ( reg_cmd_info.to ) {
+         reg_reset( 0, ukDevicePosition );
+      }
+   }
+
+   return ( returnStatus );
+}
+
+//------------------------------------------------------------------------------
+// Description: Adds a sector count to a 48-bit LBA.
+//
+// Input:  pLBA         - LBA (bits 31:0), updated
+//         pLBAHigh     - LBA (bits 47:32), updated
+//         numSectors   - sectors to add
+//
+// Output: None
+//------------------------------------------------------------------------------
+static void AddToLBA48( unsigned long* pLBA, unsigned long* pLBAHigh, unsigned long numSectors )
+{
+   *pLBA += numSectors;
+   if ( *pLBA < numSectors ) {
+      ( *pLBAHigh )++;
+   }
+}
+
+//------------------------------------------------------------------------------
+// Description: Formats a 48-bit LBA in hex for the surface scan map.
+//
+// Input:  pString      - at least LBA48_STRING_SIZE characters
+//         lba          - LBA (bits 31:0)
+//         lbaHigh      - LBA (bits 47:32)
+//
+// Output: pString
+//------------------------------------------------------------------------------
+static char* ScanHexLBA( char* pString, unsigned long lba, unsigned long lbaHigh )
+{
+   if ( lbaHigh != 0 ) {
+      sprintf( pString, "%lX%08lX", lbaHigh, lba );
+   } else {
+      sprintf( pString, "%lX", lba );
+   }
+
+   return ( pString );
+}
+
+//------------------------------------------------------------------------------
+// Description: Writes the bad sectors not in the surface scan map yet, one
+//              line for each range of consecutive bad sectors.
+//
+// Input:  None
+// Output: None
+//------------------------------------------------------------------------------
+static void ScanFlushBad( void )
+{
+   char lbaString[ LBA48_STRING_SIZE ];
+
+   if ( ( ugScanBadCount != 0 ) && ( upScanMapFile != NULL ) ) {
+      fprintf( upScanMapFile, "B %s %lu %02X %02X\n", ScanHexLBA( lbaString, ugScanBadLBA, ugScanBadLBAHigh ),
+               ugScanBadCount, ucScanBadStatus, ucScanBadError );
+   }
+   ugScanBadCount = 0;
+}
+
+//------------------------------------------------------------------------------
+// Description: Finds the failing sectors of a failed surface scan chunk by
+//              splitting it in halves and scanning each half again, down to
+//              single sectors. A chunk whose halves all pass is counted as
+//              retried (the error did not repeat).
+//
+// Input:  lba          - first LBA of the failed chunk (bits 31:0)
+//         lbaHigh      - first LBA of the failed chunk (bits 47:32)
+//         numSectors   - sectors in the chunk, >= 1
+//
+// Output: None
+//------------------------------------------------------------------------------
+static void ScanBisect( unsigned long lba, unsigned long lbaHigh, unsigned long numSectors )
+{
+   unsigned long halfLBA[ 2 ], halfLBAHigh[ 2 ], halfSectors[ 2 ], us, nextLBA, nextLBAHigh;
+   int eachHalf, failed;
+   char lbaString[ LBA48_STRING_SIZE ];
+
+   if ( numSectors == 1 ) {
+      // A bad sector, add it to the current range
+      nextLBA = ugScanBadLBA;
+      nextLBAHigh = ugScanBadLBAHigh;
+      AddToLBA48( &nextLBA, &nextLBAHigh, ugScanBadCount );
+      if ( ( ugScanBadCount != 0 ) && ( ( nextLBA != lba ) || ( nextLBAHigh != lbaHigh ) ) ) {
+         ScanFlushBad();
+      }
+      if ( ugScanBadCount == 0 ) {
+         ugScanBadLBA = lba;
+         ugScanBadLBAHigh = lbaHigh;
+         ucScanBadStatus = ucScanStatus;
+         ucScanBadError = ucScanError;
+      }
+      ugScanBadCount++;
+      upScanResult->badSectors++;
+      return;
+   }
+
+   halfLBA[ 0 ] = lba;
+   halfLBAHigh[ 0 ] = lbaHigh;
+   halfSectors[ 0 ] = numSectors / 2;
+   halfLBA[ 1 ] = lba;
+   halfLBAHigh[ 1 ] = lbaHigh;
+   AddToLBA48( &halfLBA[ 1 ], &halfLBAHigh[ 1 ], halfSectors[ 0 ] );
+   halfSectors[ 1 ] = numSectors - halfSectors[ 0 ];
+
+   failed = FALSE;
+   for ( eachHalf = 0; eachHalf < 2; eachHalf++ ) {
+      if ( ( upScanResult->stopped == TRUE ) || ( upScanResult->badSectors >= SCAN_MAX_BAD_SECTORS ) ) {
+         return;
+      }
+      if ( ScanCommand( halfLBA[ eachHalf ], halfLBAHigh[ eachHalf ], halfSectors[ eachHalf ], &us ) != NO_ERROR ) {
+         failed = TRUE;
+         ScanBisect( halfLBA[ eachHalf ], halfLBAHigh[ eachHalf ], halfSectors[ eachHalf ] );
+      }
+   }
+
+   if ( failed == FALSE ) {
+      upScanResult->retriedChunks++;
+      if ( upScanMapFile != NULL ) {
+         fprintf( upScanMapFile, "R %s %lu\n", ScanHexLBA( lbaString, lba, lbaHigh ), numSectors );
+      }
+   }
+}
+
+//------------------------------------------------------------------------------
+// Description: Scans the surface of the active device from startLBA to endLBA
+//              with READ VERIFY SECTORS EXT (no data moves, the drive runs at
+//              its media rate) or with READ DMA EXT into the scratch DMA buffer
+//              (the data also crosses the bus). The LBA28 commands are used if
+//              the device has no 48-bit addressing.
+//
+//              The scan uses the largest chunks the command allows. A failed
+//              chunk is bisected down to its bad sectors, and the next chunks
+//              are halved (down to SCAN_MIN_SECTORS_PER_CMD) so a bad area
+//              costs fewer bisect steps. They double again after each good
+//              chunk. A chunk is slow if it takes more than slowUs, or, with
+//              slowUs 0, more than SCAN_SLOW_FACTOR times the average time
+//              per sector of the chunks before it.
+//
+//              The map file has one line per chunk and per finding, LBAs are
+//              hex (48-bit): "C <LBA> <sectors> <us>" a chunk and its command time (the
+//              failed ones too), "S <LBA> <sectors> <us>" a slow chunk,
+//              "B <LBA> <sectors> <status> <error>" consecutive bad sectors,
+//              "R <LBA> <sectors>" a failed chunk whose halves all passed.
+//              Lines starting with ';' are comments.
+//
+//              The scan stops early at an IDNF error (past the end of the
+//              device, remove the HPA to scan the native max) or after
+//              SCAN_MAX_BAD_SECTORS bad sectors.
+//
+// Input:  startLBA       - first LBA (bits 31:0)
+//         startLBAHigh   - first LBA (bits 47:32)
+//         endLBA         - last LBA (bits 31:0)
+//         endLBAHigh     - last LBA (bits 47:32), end >= start
+//         useDMA         - ON = READ DMA (EXT), needs PCI DMA; OFF = READ VERIFY
+//         slowUs         - slow chunk limit in us, 0 = automatic
+//         pMapFileName   - map file, NULL = none
+//         pResult        - gets the results
+//
+// Output: NO_ERROR = whole range scanned without bad sectors; ERROR = bad
+//         sectors found, stopped early or could not start
+//------------------------------------------------------------------------------
+int SurfaceScan( unsigned long startLBA, unsigned long startLBAHigh, unsigned long endLBA, unsigned long endLBAHigh, int useDMA, unsigned long slowUs, const char* pMapFileName, struct ScanResult_t* pResult )
+{
+   unsigned long lba, lbaHigh, leftLBA, leftLBAHigh, numSectors, maxChunk, minChunk, chunk, us, perSector, avgPerSector, goodChunks, scannedMB;
+   long startTicks, lastTicks;
+   int quietMode;
+   char lbaString[ LBA48_STRING_SIZE ], endString[ LBA48_STRING_SIZE ];
+
+   memset( pResult, 0, sizeof( struct ScanResult_t ) );
+   pResult->lastLBA = startLBA;
+   pResult->lastLBAHigh = startLBAHigh;
+   if ( ( endLBAHigh < startLBAHigh ) || ( ( endLBAHigh == startLBAHigh ) && ( endLBA < startLBA ) ) ) {
+      return ( ERROR );
+   }
+
+   // No printing from the commands (EnableInterrupt() and friends)
+   quietMode = ukQuietMode;
+   ukQuietMode = ON;
+
+   Check48BitAddressingSupported();
+   ukScanLBA48 = ukReturnValue1;
+   ukScanUseDMA = useDMA;
+
+   // LBA28 commands end at LBA FFFFFFFh
+   if ( ( ukScanLBA48 == OFF ) && ( ( endLBAHigh != 0 ) || ( endLBA > 0x0FFFFFFFL ) ) ) {
+      ukQuietMode = quietMode;
+      return ( ERROR );
+   }
+
+   // Largest chunk for the command
+   if ( useDMA == ON ) {
+      if ( ( pio_bmide_base_addr == INVALID_VALUE ) || ( EnablePCIDMA() != NO_ERROR ) ) {
+         ukQuietMode = quietMode;
+         return ( ERROR );
+      }
+#if defined( __386__ )
+      maxChunk = ( lgFlatDmaSize != 0 ) ? ( lgFlatDmaSize / 512L ) : ( BUFFER_SIZE / 512 );
+#else
+      maxChunk = ( dma_pci_largeMaxS > ( BUFFER_SIZE / 512 ) ) ? dma_pci_largeMaxS : ( BUFFER_SIZE / 512 );
+#endif
+      if ( ukScanLBA48 == OFF ) {
+         maxChunk = BUFFER_SIZE / 512;
+      }
+   } else {
+      maxChunk = ( ukScanLBA48 == ON ) ? SCAN_MAX_SECTORS_PER_CMD : 256L;
+   }
+   if ( maxChunk > SCAN_MAX_SECTORS_PER_CMD ) {
+      maxChunk = SCAN_MAX_SECTORS_PER_CMD;
+   }
+   minChunk = ( maxChunk < SCAN_MIN_SECTORS_PER_CMD ) ? maxChunk : SCAN_MIN_SECTORS_PER_CMD;
+
+   upScanResult = pResult;
+   upScanMapFile = NULL;
+   ugScanBadCount = 0;
+   if ( pMapFileName != NULL ) {
+      upScanMapFile = fopen( pMapFileName, "w" );
+      if ( upScanMapFile == NULL ) {
+         ukQuietMode = quietMode;
+         return ( ERROR );
+      }
+      fprintf( upScanMapFile, "; ATACMD surface scan, LBA %s to %s, %s, up to %lu sectors per command\n",
+               ScanHexLBA( lbaString, startLBA, startLBAHigh ), ScanHexLBA( endString, endLBA, endLBAHigh ),
+               ( useDMA == ON ) ? ( ( ukScanLBA48 == ON ) ? "READ DMA EXT" : "READ DMA" )
+                                : ( ( ukScanLBA48 == ON ) ? "READ VERIFY SECTORS EXT" : "READ VERIFY SECTORS" ),
+               maxChunk );
+   }
+
+   chunk = maxChunk;
+   avgPerSector = 0;
+   goodChunks = 0;
+   lba = startLBA;
+   lbaHigh = startLBAHigh;
+   startTicks = tmr_read_bios_timer();
+   lastTicks = startTicks;
+
+   for ( ;; ) {
+      // Sectors left - 1, a 48-bit subtraction
+      leftLBA = endLBA - lba;
+      leftLBAHigh = endLBAHigh - lbaHigh - ( ( endLBA < lba ) ? 1L : 0L );
+      numSectors = ( ( leftLBAHigh == 0 ) && ( leftLBA < chunk ) ) ? ( leftLBA + 1 ) : chunk;
+
+      if ( ScanCommand( lba, lbaHigh, numSectors, &us ) == NO_ERROR ) {
+         // Time per sector in 1/16 us, the average moves 1/8 of the way
+         perSector = ( us * 16L ) / numSectors;
+         if ( upScanMapFile != NULL ) {
+            fprintf( upScanMapFile, "C %s %lu %lu\n", ScanHexLBA( lbaString, lba, lbaHigh ), numSectors, us );
+         }
+         if (    ( ( slowUs != 0 ) && ( us > slowUs ) )
+              || ( ( slowUs == 0 ) && ( goodChunks >= 8 ) && ( perSector > ( avgPerSector * SCAN_SLOW_FACTOR ) ) ) ) {
+            pResult->slowChunks++;
+            if ( upScanMapFile != NULL ) {
+               fprintf( upScanMapFile, "S %s %lu %lu\n", ScanHexLBA( lbaString, lba, lbaHigh ), numSectors, us );
+            }
+         } else {
+            avgPerSector = ( goodChunks == 0 ) ? perSector : ( avgPerSector - ( avgPerSector / 8 ) + ( perSector / 8 ) );
+            goodChunks++;
+         }
+         if ( chunk < maxChunk ) {
+            chunk *= 2;
+         }
+      } else {
+         if ( upScanMapFile != NULL ) {
+            fprintf( upScanMapFile, "C %s %lu %lu\n", ScanHexLBA( lbaString, lba, lbaHigh ), numSectors, us );
+         }
+         if ( pResult->stopped == FALSE ) {
+            ScanBisect( lba, lbaHigh, numSectors );
+         }
+         if ( chunk > minChunk ) {
+            chunk /= 2;
+         }
+      }
+
+      if ( ( pResult->stopped == TRUE ) || ( pResult->badSectors >= SCAN_MAX_BAD_SECTORS ) ) {
+         pResult->stopped = TRUE;
+         break;
+      }
+
+      AddToLBA48( &pResult->sectorsScanned, &pResult->sectorsScannedHigh, numSectors );
+      pResult->lastLBA = lba;
+      pResult->lastLBAHigh = lbaHigh;
+      AddToLBA48( &pResult->lastLBA, &pResult->lastLBAHigh, numSectors - 1 );
+
+      // Between commands, write the trace log if due
+      trc_bin_idle();
+
+      // Progress with MB/s: MB = sectors / 2048, 18.2 ticks per second
+      if ( ( quietMode == OFF ) && ( ( tmr_read_bios_timer() - lastTicks ) >= SCAN_PROGRESS_TICKS ) ) {
+         scannedMB = ( pResult->sectorsScannedHigh << 21 ) | ( pResult->sectorsScanned >> 11 );
+         lastTicks = tmr_read_bios_timer();
+         sprintf( upPrintString, "\rLBA %s of %s, %lu MB/s, %lu bad, %lu slow  ",
+                  FormatLBA48( lbaString, pResult->lastLBAHigh, pResult->lastLBA ), FormatLBA48( endString, endLBAHigh, endLBA ),
+                  ( scannedMB * 91L ) / ( ( lastTicks - startTicks ) * 5L ),
+                  pResult->badSectors, pResult->slowChunks );
+         PrintString( ukPrintOutput );
+      }
+
+      if ( ( pResult->lastLBA == endLBA ) && ( pResult->lastLBAHigh == endLBAHigh ) ) {
+         break;
+      }
+      AddToLBA48( &lba, &lbaHigh, numSectors );
+   }
+
+   pResult->ticks = tmr_read_bios_timer() - startTicks;
+
+   ScanFlushBad();
+   if ( upScanMapFile != NULL ) {
+      fprintf( upScanMapFile, "; %s at LBA %s, %s sectors, %lu bad, %lu slow, %lu retried, %lu commands, %ld ticks\n",
+               ( pResult->stopped == TRUE ) ? "stopped" : "done", ScanHexLBA( lbaString, pResult->lastLBA, pResult->lastLBAHigh ),
+               FormatLBA48( endString, pResult->sectorsScannedHigh, pResult->sectorsScanned ),
+               pResult->badSectors, pResult->slowChunks, pResult->retriedChunks, pResult->commands, pResult->ticks );
+      fclose( upScanMapFile );
+      upScanMapFile = NULL;
+   }
+
+   ukQuietMode = quietMode;
+
+   return ( ( ( pResult->stopped == FALSE ) && ( pResult->badSectors == 0 ) ) ? NO_ERROR : ERROR );
+}
+
+//------------------------------------------------------------------------------
+// Description: Read n number of sectors starting a specific LBA using UDMA
+//              transfer in 48-bit mode if supported, else 28-bit mode.  The
+//              UDMA mode must be set before using this command (SetUDMAMode).
+//
+//              Up to 65536 sectors with READ/WRITE DMA EXT. Transfers larger
+//              than BUFFER_SIZE use the LARGE PRD list, which reuses one 64KB
+//              area for all the data, so the data is not in the global buffer.
+//
+// Input:  gLBA                 - LBA address to read
+//         kNumberOfSectors     - Number of sectors to read from starting LBA
+//
+// Output: ukReturnValue1       - NO_ERROR = Read successful
+//                                ERROR    = Read unsuccessful
+//------------------------------------------------------------------------------
+void ReadDMA( unsigned long lba, unsigned long numberOfSectors )
+{
+   int returnStatus;
+   unsigned int featuresRegister, sectorCountRegister;
+   unsigned long lbaHigh;
+
+   if ( ( numberOfSectors < 1 ) || ( numberOfSectors > LARGE_DMA_MAX_SECTORS ) ) {
+      ukReturnValue1 = ERROR;
+      return;
+   }
+
+   // Configure the registers for the read DMA command
+   featuresRegister    = IGNORE_VALUE;
+   sectorCountRegister = numberOfSectors;
+   lbaHigh             = IGNORE_VALUE;
+
+   if ( ukQuietMode == OFF ) {
+      sprintf( upPrintString, "\n\nIssuing READ DMA EXT command" );
+      PrintString( ukPrintOutput );
+   }
+
+   returnStatus = SendLBA48DMACommand( CMD_READ_DMA_EXT, featuresRegister, sectorCountRegister, lba, lbaHigh );
+
+   // READ/WRITE DMA can't move more than 256 sectors
+   if ( ( returnStatus == ERROR ) && ( numberOfSectors <= 256 ) ) {
+      if ( ukQuietMode == OFF ) {
+         sprintf( upPrintString, "\n\nIssuing READ DMA command" );
+         PrintString( ukPrintOutput );
+      }
+
+      returnStatus = SendLBA28DMACommand( CMD_READ_DMA, featuresRegister, sectorCountRegister, lba );
+   }
+
+   ukReturnValue1 = returnStatus;
+   return;
+} // End ReadDMAEXT
+
+//------------------------------------------------------------------------------
+// Description: Issue a software reset command.
+//
+// Input:  None
+// Output: None
+//------------------------------------------------------------------------------
+void SoftwareReset()
+{
+   int returnStatus;
+
+   if (ukQuietMode == OFF)
+   {
+      sprintf(upPrintString, "\n\nIssuing SOFTWARE RESET command");
+      PrintString (ukPrintOutput);
+   }
+
+   // Issue a soft reset (SRST) command
+   returnStatus = reg_reset( 0, ukDevicePosition );
+
+   ukReturnValue1 = returnStatus;
+} // End SoftwareReset
+
+//------------------------------------------------------------------------------
+// Description: Issue a READ LOG EXT command to the given log address with
+//              a given transfer length.
+//
+// Input:  gLogAddress                - The log address to read
+//         gTransferLengthInSectors   - Number of sectors to read
+//
+// Output: ukReturnValue1             - NO_ERROR = Command successful
+//                                      ERROR    = Command failed
+//         *buffer                    - buffer with the log data
+//------------------------------------------------------------------------------
+void ReadLogEXT (unsigned long gLogAddress, unsigned long gTransferLengthInSectors)
+{
+   int returnStatus;
+   unsigned int kFeaturesRegister;
+   unsigned long gSectorCountRegister, gLBAHigh, gLBALow, gNumberOfSectors;
+
+   // Set up the registers before sending the command
+   kFeaturesRegister    = IGNORE_VALUE;
+   gSectorCountRegister = gTransferLengthInSectors;   // Transfer length in sectors
+   gLBAHigh             = 0;                          // Byte offset 0
+   gLBALow              = gLogAddress;                // Log address
+   gNumberOfSectors     = gTransferLengthInSectors;   // Transfer length in sectors
+
+   if (ukQuietMode == OFF)
+   {
+      sprintf(upPrintString, "\n\nIssuing READ LOG EXT command");
+      PrintString (ukPrintOutput);
+   }
+
+   // Read log EXT in LBA 48 mode
+   returnStatus = reg_pio_data_in_lba48(
+      ukDevicePosition, 0x2F,
+      kFeaturesRegister, gSectorCountRegister,
+      gLBAHigh, gLBALow,
+      FP_SEG( upBufferPtr ), FP_OFF( upBufferPtr ),
+      gNumberOfSectors, 0
+      );
+
+   ukReturnValue1 = returnStatus;
+} // End ReadLogEXT
+
+//------------------------------------------------------------------------------
+// Description: Issue a WRITE LOG EXT command to the given log address with a
+//              given transfer length and write pattern in *buffer.
+//
+// Input:  gLogAddress                - The log address to write
+//         gTransferLengthInSectors   - Number of sectors to write
+//         *buffer                    - Buffer with the pattern to be written
+//
+// Output: ukReturnValue1             - NO_ERROR = Command successful
+//                                      ERROR    = Command failed
+//------------------------------------------------------------------------------
+void WriteLogEXT (unsigned long gLogAddress, unsigned long gTransferLengthInSectors)
+{
+   int returnStatus;
+   unsigned int kFeaturesRegister;
+   unsigned long gSectorCountRegister, gLBAHigh, gLBALow, gNumberOfSectors;
+
+   // Set up the registers before sending the command
+   kFeaturesRegister    = IGNORE_VALUE;
+   gSectorCountRegister = gTransferLengthInSectors;   // Transfer length in sectors
+   gLBAHigh             = 0;                          // Byte offset 0
+   gLBALow              = gLogAddress;                // Log address
+   gNumberOfSectors     = gTransferLengthInSectors;   // Transfer length in sectors
+
+   if (ukQuietMode == OFF)
+   {
+      sprintf(upPrintString, "\n\nIssuing WRITE LOG EXT command");
       PrintString (ukPrintOutput);
    }
 
@@ -2905,7 +3940,6 @@ void SendATACommand( long int* pAtaRegs )
       case CMD_RECALIBRATE:
       case CMD_SEEK:
       case CMD_SET_FEATURES:
-      case CMD_SET_MULTIPLE_MODE:
       case CMD_SLEEP1:
       case CMD_SLEEP2:
       case CMD_STANDBY1:
@@ -2921,6 +3955,22 @@ void SendATACommand( long int* pAtaRegs )
          break;
       }
 
+      case CMD_SET_MULTIPLE_MODE:
+      {
+         // -----------------------------------------------------------------
+         // Non-data command, keep the multiple count in sync with the device
+         // -----------------------------------------------------------------
+
+         if ( SendNonDataCommand( cmd, feat, secCnt, cylinder, head, secNum ) == 0 ) {
+            ukMulti = ( ( secCnt & 0xFF ) > 1 ) ? ( secCnt & 0xFF ) : 0;
+
+            if ( uActiveDeviceIndex >= 0 ) {
+               wtStorageDevices[ uActiveDeviceIndex ].multiCnt = ( ukMulti > 1 ) ? ukMulti : 1;
+            }
+         }
+         break;
+      }
+
       case CMD_IDENTIFY_DEVICE:
       case CMD_READ_BUFFER:
       case CMD_READ_MULTIPLE:
@@ -2942,7 +3992,7 @@ void SendATACommand( long int* pAtaRegs )
          // DMA (PCI or ISA) read commands
          // -----------------------------------------------------------------
 
-         memset( buffer, 0, sizeof( buffer ) );
+         memset( buffer, 0, BUFFER_SIZE );
 
          if ( cmd == CMD_READ_DMA_EXT ) {
             SendLBA48DMACommand( cmd, feat, secCnt, lbaLow, lbaHigh );
@@ -3040,8 +4090,9 @@ int EnableInterrupt()
 {
    int error = NO_ERROR;
 
-   if ( int_use_intr_flag != TRUE ) {
-      // Only enable if not already enabled
+   // Each channel keeps its own entry in the driver's interrupt channel table,
+   // only set one up if this channel has none yet
+   if ( int_select_channel( pio_base_addr1 + 7 ) < 0 ) {
 
       // All values must be valid before enabling
       if ( ( uIRQNum != INVALID_VALUE ) && ( pio_bmide_base_addr != INVALID_VALUE ) && ( pio_base_addr1 != INVALID_VALUE ) ) {
@@ -3065,8 +4116,8 @@ int EnableInterrupt()
 }
 
 //------------------------------------------------------------------------------
-// Description: Restore original interrupt handler only if ours was installed.
-//              Must do this before exiting out of program!
+// Description: Disable interrupt mode for the active channel, restores the
+//              original interrupt handler if ours was installed.
 //
 // Input:  None
 //
@@ -3092,6 +4143,13 @@ int EnablePCIDMA()
       error = NO_ERROR;                                     // already enabled
    } else if ( pio_bmide_base_addr != INVALID_VALUE ) {
       error = dma_pci_config( pio_bmide_base_addr );        // not enabled, so enable
+
+      // Allow LARGE PRD transfers if the large DMA buffer qualifies. PIO and
+      // SIMPLE DMA keep using the global buffer, so keep its size.
+      if ( ( error == NO_ERROR ) && ( upLargeDmaBuffer != NULL ) ) {
+         dma_pci_set_max_xfer( FP_SEG( upLargeDmaBuffer ), FP_OFF( upLargeDmaBuffer ), LARGE_DMA_BUFFER_SIZE );
+         reg_buffer_size = BUFFER_SIZE;
+      }
    } else {
       error = ERROR;                                        // invalid bmide address, can't enable
    }
@@ -3368,12 +4426,209 @@ unsigned int ScanForStorageDevices()
    return ( totalDevicesFound );
 } // End ScanForStorageDevices
 
+//------------------------------------------------------------------------------
+// Description: Measures the PIO data transfer width for the active device in
+//              its sector buffer (READ BUFFER/WRITE BUFFER), the media is
+//              never touched. A pattern is written and read back with 16-bit
+//              PIO as the reference, and the IDENTIFY DEVICE data is read with
+//              16-bit and 32-bit PIO and compared. Then the buffer is read back
+//              to back for PIO_CALIBRATION_TICKS with 16-bit and with 32-bit
+//              PIO, every read compared with the reference. Writes use the same
+//              width, so the inverted pattern is written with 32-bit PIO and
+//              read with 16-bit PIO. 32-bit is only picked if every transfer
+//              matched and it completed more reads than 16-bit.
+// Note:        A failed 32-bit transfer resets the channel (SRST), which resets
+//              both devices on it.
+//
+// Input:  None
+//
+// Output: 16 or 32 - PIO transfer width for the active device
+//------------------------------------------------------------------------------
+static int MeasurePIOWidth( void )
+{
+   static unsigned char wcRefId[ 512 ];
+   static unsigned char wcRefData[ 512 ];
+   static unsigned char wcTestData[ 512 ];
+   long readCount[ 2 ];
+   long startTime, endTime;
+   int widthIdx, eachByte, returnStatus;
+
+   // Reference data using 16-bit PIO
+   pio_xfer_width = 16;
+
+   returnStatus = reg_pio_data_in_lba28(
+      ukDevicePosition, CMD_IDENTIFY_DEVICE,
+      0, 0,
+      0L,
+      FP_SEG( wcRefId ), FP_OFF( wcRefId ),
+      1, 0
+      );
+
+   // Word 82 bit 12 - WRITE BUFFER supported, bit 13 - READ BUFFER supported
+   if ( returnStatus || ( ( wcRefId[ ( 82 * 2 ) + 1 ] & 0x30 ) != 0x30 ) ) {
+      return ( 16 );
+   }
+
+   // Every word differs from its neighbours, so dropped or swapped words show
+   for ( eachByte = 0; eachByte < sizeof( wcRefData ); eachByte++ ) {
+      wcRefData[ eachByte ] = (unsigned char) ( ( eachByte * 0x1D ) ^ ( eachByte >> 8 ) ^ 0xA5 );
+   }
+
+   returnStatus = reg_pio_data_out_lba28(
+      ukDevicePosition, CMD_WRITE_BUFFER,
+      0, 0,
+      0L,
+      FP_SEG( wcRefData ), FP_OFF( wcRefData ),
+      1, 0
+      );
+
+   if ( returnStatus == 0 ) {
+      memset( wcTestData, 0, sizeof( wcTestData ) );
+
+      returnStatus = reg_pio_data_in_lba28(
+         ukDevicePosition, CMD_READ_BUFFER,
+         0, 0,
+         0L,
+         FP_SEG( wcTestData ), FP_OFF( wcTestData ),
+         1, 0
+         );
+   }
+
+   if ( returnStatus || memcmp( wcRefData, wcTestData, sizeof( wcTestData ) ) ) {
+      return ( 16 );
+   }
+
+   // The ID data is never all zeros or all ones, so check it first
+   pio_xfer_width = 32;
+   memset( wcTestData, 0, sizeof( wcTestData ) );
+
+   returnStatus = reg_pio_data_in_lba28(
+      ukDevicePosition, CMD_IDENTIFY_DEVICE,
+      0, 0,
+      0L,
+      FP_SEG( wcTestData ), FP_OFF( wcTestData ),
+      1, 0
+      );
+
+   if ( returnStatus || memcmp( wcRefId, wcTestData, sizeof( wcTestData ) ) ) {
+      pio_xfer_width = 16;
+      reg_reset( 0, ukDevicePosition );
+      return ( 16 );
+   }
+
+   // Time back to back reads of the buffer, 16-bit then 32-bit
+   for ( widthIdx = 0; widthIdx < 2; widthIdx++ )
+   {
+      pio_xfer_width = ( widthIdx == 0 ) ? 16 : 32;
+      readCount[ widthIdx ] = 0;
+
+      // Start on a timer tick
+      startTime = tmr_read_bios_timer();
+      while ( tmr_read_bios_timer() == startTime ) {}
+      startTime++;
+      endTime = startTime + PIO_CALIBRATION_TICKS;
+
+      while ( ( tmr_read_bios_timer() < endTime ) && ( tmr_read_bios_timer() >= startTime ) )
+      {
+         memset( wcTestData, 0, sizeof( wcTestData ) );
+
+         returnStatus = reg_pio_data_in_lba28(
+            ukDevicePosition, CMD_READ_BUFFER,
+            0, 0,
+            0L,
+            FP_SEG( wcTestData ), FP_OFF( wcTestData ),
+            1, 0
+            );
+
+         if ( returnStatus || memcmp( wcRefData, wcTestData, sizeof( wcTestData ) ) ) {
+            pio_xfer_width = 16;
+            reg_reset( 0, ukDevicePosition );
+            return ( 16 );
+         }
+
+         readCount[ widthIdx ]++;
+      }
+   }
+
+   pio_xfer_width = 16;
+
+   if ( readCount[ 1 ] <= readCount[ 0 ] ) {
+      return ( 16 );
+   }
+
+   // Write the inverted pattern with 32-bit PIO, check it with 16-bit PIO
+   for ( eachByte = 0; eachByte < sizeof( wcRefData ); eachByte++ ) {
+      wcRefData[ eachByte ] = (unsigned char) ~wcRefData[ eachByte ];
+   }
+
+   pio_xfer_width = 32;
+
+   returnStatus = reg_pio_data_out_lba28(
+      ukDevicePosition, CMD_WRITE_BUFFER,
+      0, 0,
+      0L,
+      FP_SEG( wcRefData ), FP_OFF( wcRefData ),
+      1, 0
+      );
+
+   pio_xfer_width = 16;
+
+   if ( returnStatus ) {
+      reg_reset( 0, ukDevicePosition );
+      return ( 16 );
+   }
+
+   memset( wcTestData, 0, sizeof( wcTestData ) );
+
+   returnStatus = reg_pio_data_in_lba28(
+      ukDevicePosition, CMD_READ_BUFFER,
+      0, 0,
+      0L,
+      FP_SEG( wcTestData ), FP_OFF( wcTestData ),
+      1, 0
+      );
+
+   if ( returnStatus || memcmp( wcRefData, wcTestData, sizeof( wcTestData ) ) ) {
+      return ( 16 );
+   }
+
+   return ( 32 );
+} // End MeasurePIOWidth
+
+//------------------------------------------------------------------------------
+// Description: Picks the PIO data transfer width for the active device (see
+//              MeasurePIOWidth()) and keeps it for the device. Devices that
+//              are never calibrated use 16-bit PIO. Only called on request
+//              (ATACMD "piowidth cal"), never by SetActiveDevice().
+// Note:        Sends commands to the device. Needs READ BUFFER and WRITE
+//              BUFFER (IDENTIFY word 82 bits 13 and 12), else 16-bit is kept.
+//              A failed 32-bit transfer resets both devices on the channel.
+//
+// Input:  None
+//
+// Output: 16 or 32 - PIO transfer width now used for the active device
+//------------------------------------------------------------------------------
+int CalibratePIOWidth( void )
+{
+   int width;
+
+   width = MeasurePIOWidth();
+   if ( ( uActiveDeviceIndex >= 0 ) && ( uActiveDeviceIndex < MAX_STORAGE_DEVICES ) ) {
+      wtStorageDevices[ uActiveDeviceIndex ].pioWidth = width;
+   }
+   pio_xfer_width = width;
+
+   return ( width );
+} // End CalibratePIOWidth
+
 //------------------------------------------------------------------------------
 // Description: Copies the base, controller, and bmide address of the device to
 //              the library's global variables so each command sent will be
 //              sent to those addresses.
 // Note:        Sends NO data to the device so user must make sure a device is
-//              attached.
+//              attached. The PIO width is the one from CalibratePIOWidth(),
+//              16-bit until then, and multiple mode is set before the first
+//              READ/WRITE MULTIPLE (see UseMultipleMode()).
 //
 // Input:  deviceIndex        - index into array of found devices. Use
 //                              ScanForStorageDevices() first to populate this
@@ -3406,16 +4661,23 @@ void SetActiveDevice( unsigned int deviceIndex )
    uIRQNum = wtStorageDevices[ deviceIndex ].irqNum;
    dma_pci_enabled_flag = 0;
    
-   // Restore interrupt handler if it was modified with previous device's IRQ number
-   DisableInterrupt();
-   
    // Align the I/O ports to the driver's variables
    pio_set_iobase_addr( cmdBase, ctrlBase, bmideBase );
+
+   // Interrupt mode of the previous device's channel stays set up, this
+   // channel's entry (if any) becomes the active one
+   int_select_channel( cmdBase + 7 );
    
    // This info is needed by the driver
    reg_config_info[ 0 ] = wtStorageDevices[ deviceIndex ].regInfo0;
    reg_config_info[ 1 ] = wtStorageDevices[ deviceIndex ].regInfo1;
    
+   // PIO width picked by CalibratePIOWidth(), 16-bit if never calibrated
+   pio_xfer_width = ( wtStorageDevices[ deviceIndex ].pioWidth != 0 ) ? wtStorageDevices[ deviceIndex ].pioWidth : 16;
+
+   // Multiple count set by UseMultipleMode() or SET MULTIPLE MODE, 0 = not set yet
+   ukMulti = ( wtStorageDevices[ deviceIndex ].multiCnt > 1 ) ? wtStorageDevices[ deviceIndex ].multiCnt : 0;
+
    uActiveDeviceIndex = deviceIndex;
 
    return;
@@ -3464,6 +4726,499 @@ struct StorageDevice_t* GetDeviceInfo( unsigned int deviceIndex )
    return ( pDeviceInfo );
 }
 
+//------------------------------------------------------------------------------
+// Description: Checks if another job has a command in flight on the same
+//              channel (cable) as pJob. Master and slave share the task file
+//              registers, so only one of them may run a command at a time.
+//
+// Input:  pJobs        - job list
+//         numJobs      - number of jobs in the list
+//         pJob         - job that wants to start a command
+//
+// Output: TRUE = channel busy, FALSE = channel free
+//------------------------------------------------------------------------------
+static int SchedChannelBusy( struct SchedJob_t* pJobs, unsigned int numJobs, struct SchedJob_t* pJob )
+{
+   unsigned int eachJob;
+
+   for ( eachJob = 0; eachJob < numJobs; eachJob++ ) {
+      if ( ( &pJobs[ eachJob ] != pJob ) &&
+           ( pJobs[ eachJob ].cmdCtx.state != ASY_STATE_IDLE ) &&
+           ( wtStorageDevices[ pJobs[ eachJob ].deviceIndex ].cmdBase == wtStorageDevices[ pJob->deviceIndex ].cmdBase ) ) {
+         return ( TRUE );
+      }
+   }
+
+   return ( FALSE );
+}
+
+//------------------------------------------------------------------------------
+// Description: Returns a DMA data area of RunScheduledJobs(), each DMA command
+//              in flight has one of its own. The 32-bit build splits the flat
+//              DMA buffer into ASY_MAX_DMA areas, the 16-bit build allocates a
+//              BUFFER_SIZE area that does not cross 64KB the first time it is
+//              used. Without the memory only area 0 is there, the global
+//              buffer.
+//
+// Input:  area         - 0 to ASY_MAX_DMA - 1
+//         pSize        - size of the area in bytes
+//
+// Output: far pointer to the area, NULL = not available
+//------------------------------------------------------------------------------
+static unsigned char far* SchedDmaArea( int area, long* pSize )
+{
+#if defined( __386__ )
+   if ( lgFlatDmaSize != 0 ) {
+      *pSize = lgFlatDmaSize / ASY_MAX_DMA;
+      return ( (unsigned char far *) ATA_PTR( ATA_LINEAR( ukFlatDmaSeg, ukFlatDmaOff ) + ( area * *pSize ) ) );
+   }
+#else
+   unsigned int seg;
+   unsigned int off;
+
+   if ( ( upSchedDmaArea[ area ] == NULL ) && ( dma_alloc_aligned_buf( BUFFER_SIZE, &seg, &off ) == 0 ) ) {
+      upSchedDmaArea[ area ] = (unsigned char far *) ATA_PTR( ATA_LINEAR( seg, off ) );
+   }
+   if ( upSchedDmaArea[ area ] != NULL ) {
+      *pSize = BUFFER_SIZE;
+      return ( upSchedDmaArea[ area ] );
+   }
+#endif
+
+   if ( area != 0 ) {
+      return ( NULL );
+   }
+   *pSize = BUFFER_SIZE;
+   return ( upBufferPtr );
+}
+
+//------------------------------------------------------------------------------
+// Description: Runs a list of jobs on several devices at the same time. Each
+//              device gets its own command context (ports, device, state) and
+//              the jobs are served round robin: a finished command is
+//              completed and the job's next command is started as soon as
+//              its channel is free. Independent channels (primary/secondary
+//              ports, separate PCI controllers) run in parallel, master/slave
+//              pairs on one channel take turns. Up to ASY_MAX_DMA DMA commands
+//              (one per channel) are in flight at a time, each with a data
+//              area of its own (see SchedDmaArea()); data that fits the global
+//              buffer is copied in and out. PIO jobs share upBufferPtr, so they
+//              must fit sectorsPerCmd in BUFFER_SIZE. A DMA command larger than
+//              its area gets fewer sectors, except in the 16-bit build while
+//              the LARGE PRD list is free: one 64KB area is reused for all the
+//              data, so only for data that repeats, such as a fill pattern, see
+//              FillDMABuffers(). When the binary trace log is due to be written
+//              no new commands are started, the log is written once none is in
+//              flight. Returns when every job is finished or has failed.
+//
+// Input:  pJobs        - job list (deviceIndex, prot, cmd, lba, lbaHigh,
+//                        sectorsPerCmd and commandsLeft filled in)
+//         numJobs      - number of jobs in the list
+//
+// Output: commandsDone, lba, lbaHigh and errorCode of each job
+//------------------------------------------------------------------------------
+void RunScheduledJobs( struct SchedJob_t* pJobs, unsigned int numJobs )
+{
+   unsigned int eachJob, jobsPending, cmdsInFlight, sectors;
+   int area, logDue;
+   int areaBusy[ ASY_MAX_DMA ];
+#if ! defined( __386__ )
+   int largeArea;
+#endif
+   struct SchedJob_t* pJob;
+   struct StorageDevice_t* pDevice;
+   unsigned char far* pBuffer;
+   long areaSize, prevTimeout;
+
+   for ( eachJob = 0; eachJob < numJobs; eachJob++ ) {
+      pJobs[ eachJob ].cmdCtx.state = ASY_STATE_IDLE;
+      pJobs[ eachJob ].commandsDone = 0;
+      pJobs[ eachJob ].errorCode = 0;
+      pJobs[ eachJob ].dmaArea = -1;
+   }
+   for ( area = 0; area < ASY_MAX_DMA; area++ ) {
+      areaBusy[ area ] = FALSE;
+   }
+#if ! defined( __386__ )
+   largeArea = -1;
+#endif
+
+   do {
+      jobsPending = 0;
+      logDue = trc_bin_flush_due();
+
+      for ( eachJob = 0; eachJob < numJobs; eachJob++ ) {
+         pJob = &pJobs[ eachJob ];
+
+         // Command in flight, move it forward
+         if ( pJob->cmdCtx.state != ASY_STATE_IDLE ) {
+            jobsPending++;
+            if ( asy_poll( &pJob->cmdCtx ) ) {
+               if ( asy_complete( &pJob->cmdCtx ) ) {
+                  pJob->errorCode = pJob->cmdCtx.info.ec;
+                  pJob->commandsLeft = 0;
+               } else {
+                  pJob->commandsDone++;
+                  pJob->lba += pJob->sectorsInFlight;
+                  if ( pJob->lba < pJob->sectorsInFlight ) {
+                     pJob->lbaHigh++;
+                  }
+               }
+               if ( pJob->dmaArea >= 0 ) {
+                  // The data of a command that fits the global buffer goes back there
+                  pBuffer = SchedDmaArea( pJob->dmaArea, &areaSize );
+                  if ( ( pBuffer != upBufferPtr ) && ( ( (long) pJob->sectorsInFlight * 512L ) <= BUFFER_SIZE ) ) {
+                     memcpy( upBufferPtr, pBuffer, pJob->sectorsInFlight * 512U );
+                  }
+                  areaBusy[ pJob->dmaArea ] = FALSE;
+#if ! defined( __386__ )
+                  if ( pJob->dmaArea == largeArea ) {
+                     largeArea = -1;
+                  }
+#endif
+                  pJob->dmaArea = -1;
+               }
+            }
+            continue;
+         }
+
+         if ( pJob->commandsLeft <= 0 ) {
+            continue;
+         }
+         jobsPending++;
+
+         // Wait for the channel, or for the trace log
+         if ( logDue || SchedChannelBusy( pJobs, numJobs, pJob ) ) {
+            continue;
+         }
+
+         pBuffer = upBufferPtr;
+         sectors = pJob->sectorsPerCmd;
+         if ( pJob->prot == ASY_PROT_DMA ) {
+            // Wait for a free DMA data area
+            for ( area = 0; area < ASY_MAX_DMA; area++ ) {
+               if ( ( ! areaBusy[ area ] ) && ( ( pBuffer = SchedDmaArea( area, &areaSize ) ) != NULL ) ) {
+                  break;
+               }
+            }
+            if ( area >= ASY_MAX_DMA ) {
+               continue;
+            }
+
+#if ! defined( __386__ )
+            // Larger than the area, the LARGE PRD list if no other command uses it
+            if ( ( ( (long) sectors * 512L ) > areaSize ) && ( largeArea < 0 ) &&
+                 ( ( (long) sectors * 512L ) <= dma_pci_largeMaxB ) ) {
+               dma_pci_prd_type = PRD_TYPE_LARGE;
+               largeArea = area;
+               areaSize = dma_pci_largeMaxB;
+            }
+#endif
+            if ( ( (long) sectors * 512L ) > areaSize ) {
+               sectors = (unsigned int) ( areaSize / 512L );
+            }
+            if ( ( pBuffer != upBufferPtr ) && ( ( (long) sectors * 512L ) <= BUFFER_SIZE ) ) {
+               memcpy( pBuffer, upBufferPtr, sectors * 512U );
+            }
+            reg_buffer_size = areaSize;
+            areaBusy[ area ] = TRUE;
+            pJob->dmaArea = area;
+         }
+         pJob->sectorsInFlight = sectors;
+
+         // Start the next command with this device's register context
+         pDevice = &wtStorageDevices[ pJob->deviceIndex ];
+         asy_setup_lba48( &pJob->cmdCtx, pJob->prot, pDevice->masterSlave, pJob->cmd,
+                          0, sectors, pJob->lbaHigh, pJob->lba,
+                          FP_SEG( pBuffer ), FP_OFF( pBuffer ), sectors, pJob->multiCnt );
+         pJob->cmdCtx.base1 = pDevice->cmdBase;
+         pJob->cmdCtx.base2 = pDevice->ctrlBase;
+         pJob->cmdCtx.bmide = pDevice->bmideBase;
+         pJob->cmdCtx.configInfo[ 0 ] = pDevice->regInfo0;
+         pJob->cmdCtx.configInfo[ 1 ] = pDevice->regInfo1;
+         if ( pDevice->pioWidth != 0 ) {
+            pJob->cmdCtx.xferWidth = pDevice->pioWidth;
+         }
+         pJob->commandsLeft--;
+         prevTimeout = ScaleCommandTimeout( (unsigned char) pJob->cmd, sectors );
+         asy_submit( &pJob->cmdCtx );
+         tmr_set_cmd_code_timeout( (unsigned char) pJob->cmd, prevTimeout );
+         dma_pci_prd_type = PRD_TYPE_SIMPLE;
+         reg_buffer_size = BUFFER_SIZE;
+      }
+
+      // The trace log is only written with no command in flight
+      cmdsInFlight = 0;
+      for ( eachJob = 0; eachJob < numJobs; eachJob++ ) {
+         if ( pJobs[ eachJob ].cmdCtx.state != ASY_STATE_IDLE ) {
+            cmdsInFlight++;
+         }
+      }
+      if ( cmdsInFlight == 0 ) {
+         trc_bin_idle();
+      }
+   } while ( jobsPending > 0 );
+
+   return;
+} // End RunScheduledJobs
+
+//------------------------------------------------------------------------------
+// Description: Fills the buffers the overwrite jobs write from with one byte:
+//              the global buffer (PIO), the LARGE PRD I/O area (16-bit build)
+//              or the flat DMA buffer (32-bit build). Other commands reuse the
+//              global buffer, so fill it again before each RunScheduledJobs().
+//
+// Input:  fillByte     - fill byte
+//
+// Output: None
+//------------------------------------------------------------------------------
+void FillDMABuffers( unsigned char fillByte )
+{
+   memset( upBufferPtr, fillByte, BUFFER_SIZE );
+
+#if defined( __386__ )
+   if ( lgFlatDmaSize != 0 ) {
+      memset( ATA_PTR( ATA_LINEAR( ukFlatDmaSeg, ukFlatDmaOff ) ), fillByte, lgFlatDmaSize );
+   }
+#else
+   // The 64KB area in two halves, memset() takes up to 65535 bytes
+   if ( dma_pci_largeIoBufPtr != NULL ) {
+      memset( dma_pci_largeIoBufPtr, fillByte, 32768U );
+      memset( dma_pci_largeIoBufPtr + 32768U, fillByte, 32768U );
+   }
+#endif
+
+   return;
+}
+
+//------------------------------------------------------------------------------
+// Description: Returns the nonzero xorshift32 state that starts the
+//              PATTERN_RANDOM words of a sector, so any sector can be made
+//              again from the seed and its LBA alone.
+//
+// Input:  seed         - pattern seed
+//         lba          - LBA of the sector
+//
+// Output: xorshift32 state
+//------------------------------------------------------------------------------
+static unsigned long PatternSectorState( unsigned long seed, unsigned long lba )
+{
+   unsigned long state;
+
+   state = seed ^ ( lba * 0x9E3779B9L );
+   if ( state == 0 ) {
+      state = 0x9E3779B9L;
+   }
+
+   return ( state );
+}
+
+//------------------------------------------------------------------------------
+// Description: Fills a buffer with a data pattern a 32-bit word at a time, a
+//              sector (PATTERN_WORDS_PER_SECTOR words) per LBA. The 16-bit
+//              build needs the buffer within one segment.
+//
+// Input:  pBuffer      - buffer to fill
+//         numBytes     - bytes to fill, a multiple of 4
+//         pattern      - PATTERN_CONSTANT, PATTERN_LBA or PATTERN_RANDOM
+//         seed         - fill word (PATTERN_CONSTANT, PATTERN_LBA) or
+//                        xorshift32 seed (PATTERN_RANDOM)
+//         lba          - LBA of the first sector in the buffer
+//
+// Output: None
+//------------------------------------------------------------------------------
+void FillPattern( unsigned char far* pBuffer, unsigned long numBytes, int pattern, unsigned long seed, unsigned long lba )
+{
+   unsigned long far* pWord;
+   unsigned long numWords, state;
+   unsigned int eachWord, sectorWords;
+
+   pWord = (unsigned long far*) pBuffer;
+   numWords = numBytes / 4L;
+
+   while ( numWords > 0 ) {
+      sectorWords = ( numWords < PATTERN_WORDS_PER_SECTOR ) ? (unsigned int) numWords : PATTERN_WORDS_PER_SECTOR;
+
+      if ( pattern == PATTERN_RANDOM ) {
+         state = PatternSectorState( seed, lba );
+         for ( eachWord = 0; eachWord < sectorWords; eachWord++ ) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            pWord[ eachWord ] = state;
+         }
+      } else {
+         for ( eachWord = 0; eachWord < sectorWords; eachWord++ ) {
+            pWord[ eachWord ] = seed;
+         }
+         if ( pattern == PATTERN_LBA ) {
+            pWord[ 0 ] = lba;
+         }
+      }
+
+      pWord += sectorWords;
+      numWords -= sectorWords;
+      lba++;
+   }
+
+   return;
+}
+
+//------------------------------------------------------------------------------
+// Description: Compares a buffer with the data pattern FillPattern() makes
+//              from the same arguments, a 32-bit word at a time. The byte of
+//              the first mismatching word comes from the lowest nonzero byte
+//              of the XOR of the two words (little endian). The 16-bit build
+//              needs the buffer within one segment.
+//
+// Input:  pBuffer      - buffer to check
+//         numBytes     - bytes to check, a multiple of 4
+//         pattern      - PATTERN_CONSTANT, PATTERN_LBA or PATTERN_RANDOM
+//         seed         - fill word or xorshift32 seed, see FillPattern()
+//         lba          - LBA of the first sector in the buffer
+//
+// Output: -1 = buffer matches, else byte offset of the first mismatch
+//         ugReturnValue1 - expected word at the mismatch
+//         ugReturnValue2 - word found at the mismatch
+//------------------------------------------------------------------------------
+long ComparePattern( const unsigned char far* pBuffer, unsigned long numBytes, int pattern, unsigned long seed, unsigned long lba )
+{
+   const unsigned long far* pWord;
+   unsigned long numWords, wordsDone, state, expected, diff;
+   unsigned int eachWord, sectorWords;
+
+   pWord = (const unsigned long far*) pBuffer;
+   numWords = numBytes / 4L;
+   wordsDone = 0L;
+
+   while ( numWords > 0 ) {
+      sectorWords = ( numWords < PATTERN_WORDS_PER_SECTOR ) ? (unsigned int) numWords : PATTERN_WORDS_PER_SECTOR;
+      eachWord = 0;
+
+      // Each loop stops at the first mismatch with the expected word set
+      if ( pattern == PATTERN_RANDOM ) {
+         state = PatternSectorState( seed, lba );
+         for ( ; eachWord < sectorWords; eachWord++ ) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            if ( pWord[ eachWord ] != state ) {
+               break;
+            }
+         }
+         expected = state;
+      } else if ( ( pattern == PATTERN_LBA ) && ( pWord[ 0 ] != lba ) ) {
+         expected = lba;
+      } else {
+         if ( pattern == PATTERN_LBA ) {
+            eachWord = 1;
+         }
+         for ( ; eachWord < sectorWords; eachWord++ ) {
+            if ( pWord[ eachWord ] != seed ) {
+               break;
+            }
+         }
+         expected = seed;
+      }
+
+      if ( eachWord < sectorWords ) {
+         diff = pWord[ eachWord ] ^ expected;
+         ugReturnValue1 = expected;
+         ugReturnValue2 = pWord[ eachWord ];
+         return ( (long) ( ( wordsDone + eachWord ) * 4L ) +
+                  ( ( diff & 0x000000FFL ) ? 0 : ( diff & 0x0000FF00L ) ? 1 : ( diff & 0x00FF0000L ) ? 2 : 3 ) );
+      }
+
+      pWord += sectorWords;
+      wordsDone += sectorWords;
+      numWords -= sectorWords;
+      lba++;
+   }
+
+   return ( -1L );
+}
+
+//------------------------------------------------------------------------------
+// Description: Sets up a scheduler job (see RunScheduledJobs()) that overwrites
+//              a device from LBA 0 to its native max LBA (48-bit). A volatile
+//              SET MAX ADDRESS EXT opens an HPA until the next power cycle.
+//              With PCI DMA the job uses WRITE DMA
+//              EXT with the largest transfer the DMA buffers allow (up to
+//              OVERWRITE_MAX_SECTORS_PER_CMD), else WRITE MULTIPLE EXT with the
+//              device's DRQ block size (WRITE SECTORS EXT without multiple
+//              mode) and BUFFER_SIZE per command. The caller
+//              fills the buffers (FillDMABuffers()) and sets commandsLeft.
+//
+// Input:  deviceIndex  - index into the found devices
+//         pJob         - job to set up
+//
+// Output: NO_ERROR = job set up; ERROR = no 48-bit addressing or no native max
+//         ugReturnValue1 - native max LBA (bits 31:0)
+//         ugReturnValue2 - native max LBA (bits 47:32)
+//------------------------------------------------------------------------------
+int OverwriteJobSetup( unsigned int deviceIndex, struct SchedJob_t* pJob )
+{
+   unsigned long maxLBA, maxLBAHigh, maxSectors;
+   int multiCnt;
+
+   SetActiveDevice( deviceIndex );
+
+   Check48BitAddressingSupported();
+   if ( ukReturnValue1 != ON ) {
+      return ( ERROR );
+   }
+
+   GetMaxLBAFromReadNativeMax();
+   if ( ukReturnValue1 != NO_ERROR ) {
+      return ( ERROR );
+   }
+
+   // Open the HPA, SET MAX ADDRESS EXT must follow READ NATIVE MAX ADDRESS
+   // EXT and fails if there is no HPA
+   maxLBA = ugReturnValue1;
+   maxLBAHigh = ugReturnValue2;
+   SetMaxAddress( LBA48_MODE, HPA_VOLATILE, maxLBA, maxLBAHigh );
+
+   memset( pJob, 0, sizeof( struct SchedJob_t ) );
+   pJob->deviceIndex = deviceIndex;
+   pJob->lba = 0L;
+   pJob->lbaHigh = 0L;
+
+   // DMA stays enabled once another device enabled it, check for a BMIDE too
+   if ( ( wtStorageDevices[ deviceIndex ].bmideBase != INVALID_VALUE ) && ( EnablePCIDMA() == NO_ERROR ) ) {
+#if defined( __386__ )
+      maxSectors = ( lgFlatDmaSize / ASY_MAX_DMA ) / 512L;
+#else
+      maxSectors = dma_pci_largeMaxS;
+#endif
+      if ( maxSectors < ( BUFFER_SIZE / 512 ) ) {
+         maxSectors = BUFFER_SIZE / 512;
+      }
+      if ( maxSectors > OVERWRITE_MAX_SECTORS_PER_CMD ) {
+         maxSectors = OVERWRITE_MAX_SECTORS_PER_CMD;
+      }
+      pJob->prot = ASY_PROT_DMA;
+      pJob->cmd = CMD_WRITE_DMA_EXT;
+      pJob->sectorsPerCmd = (unsigned int) maxSectors;
+   } else {
+      UseMultipleMode();
+      multiCnt = wtStorageDevices[ deviceIndex ].multiCnt;
+      pJob->prot = ASY_PROT_PDO;
+      if ( multiCnt > 1 ) {
+         pJob->cmd = CMD_WRITE_MULTIPLE_EXT;
+         pJob->multiCnt = multiCnt;
+         pJob->sectorsPerCmd = ( ( BUFFER_SIZE / 512 ) / multiCnt ) * multiCnt;
+      } else {
+         pJob->cmd = CMD_WRITE_SECTORS_EXT;
+         pJob->sectorsPerCmd = BUFFER_SIZE / 512;
+      }
+   }
+
+   ugReturnValue1 = maxLBA;
+   ugReturnValue2 = maxLBAHigh;
+   return ( NO_ERROR );
+}
+
 //------------------------------------------------------------------------------
 // Description: Displays all the found devices after ScanForStorageDevices()
 //              is called.
@@ -3620,7 +5375,7 @@ int GetSmartAttributes()
    }
 
    // Clear the buffer so there's no remnant data in buffer before reading
-   memset( buffer, 0, sizeof( buffer ) );
+   memset( buffer, 0, BUFFER_SIZE );
 
    returnStatus = reg_pio_data_in_lba28( ukDevicePosition,
       CMD_SMART, SMART_READ_DATA,
@@ -93,6 +93,28 @@
 #define MAX_STORAGE_DEVICES                     ( 16 )            // Arbitrary value, can be expanded
 #define VALID_DEVICE_ENTRY                      ( 0xDCDC )
 
+#define LARGE_DMA_BUFFER_SIZE                   ( 0x21000L )      // 64KB I/O area + 4KB PRD list + 64KB alignment
+#define LARGE_DMA_MAX_SECTORS                   ( 65536L )        // Max sectors of one READ/WRITE DMA EXT
+#define FLAT_DMA_BUFFER_SIZE                    ( 33554432L )     // 32-bit build: DMA buffer, 65536 sectors
+#define FLAT_DMA_MIN_BUFFER_SIZE                ( 65536L )        // 32-bit build: smallest DMA buffer tried
+#define STREAM_MAX_SECTORS                      ( 65536L )        // Max sectors of one streamed LBA48 command
+#define TIMEOUT_MIN_KB_PER_SECOND               ( 512L )          // Slowest rate a long transfer command gets time for
+#define PIPE_MAX_SECTORS_PER_CMD                ( BUFFER_SIZE / 512 ) // Sectors per command of a pipelined DMA read
+#define PIO_CALIBRATION_TICKS                   ( 3L )            // BIOS ticks (~55ms) timed per PIO width
+#define SCAN_MAX_SECTORS_PER_CMD                ( 65536L )        // Largest surface scan chunk (one LBA48 command)
+#define SCAN_MIN_SECTORS_PER_CMD                ( 256L )          // Smallest chunk the scan shrinks to after an error
+#define SCAN_MAX_BAD_SECTORS                    ( 4096L )         // Surface scan stops after this many bad sectors
+#define SCAN_SLOW_FACTOR                        ( 4L )            // Chunk is slow at this many times the average time per sector
+#define SCAN_PROGRESS_TICKS                     ( 18L )           // BIOS ticks between surface scan progress lines
+#define OVERWRITE_MAX_SECTORS_PER_CMD           ( 32768L )        // Largest overwrite command, fits the 16-bit sectorsPerCmd
+#define LBA48_STRING_SIZE                       ( 16 )            // FormatLBA48() string, 15 digits + NUL
+#define PATTERN_WORDS_PER_SECTOR                ( 128 )           // 32-bit words per 512-byte sector
+
+// Data patterns of FillPattern() and ComparePattern()
+#define PATTERN_CONSTANT                        ( 0 )             // every word is the seed
+#define PATTERN_LBA                             ( 1 )             // first word of a sector is its LBA, the rest the seed
+#define PATTERN_RANDOM                          ( 2 )             // xorshift32 per sector, started from the seed and LBA
+
 //---------------------------------[ENUMS]--------------------------------------
 
 // Enums
@@ -123,6 +145,47 @@ struct StorageDevice_t {
    unsigned int masterSlave;
    unsigned int regInfo0;
    unsigned int regInfo1;
+   unsigned int pioWidth;     // PIO width from CalibratePIOWidth() (16 or 32), 0 = not calibrated, 16-bit
+   unsigned int multiCnt;     // Sectors per DRQ block set with SET MULTIPLE MODE, 0 = not set yet
+};
+
+// One job of the multi-device command scheduler (see RunScheduledJobs()). A job
+// issues commandsLeft LBA48 commands of sectorsPerCmd sectors each to one
+// device, starting at lbaHigh:lba. Needs ataio.h for struct ASY_CMD.
+struct SchedJob_t {
+   unsigned int deviceIndex;     // index into wtStorageDevices
+   int prot;                     // ASY_PROT_ND, ASY_PROT_PDI, ASY_PROT_PDO or ASY_PROT_DMA
+   int cmd;                      // LBA48 command code
+   unsigned long lba;            // LBA of the next command (bits 31:0)
+   unsigned long lbaHigh;        // LBA of the next command (bits 47:32)
+   unsigned int sectorsPerCmd;   // sectors per command
+   unsigned int sectorsInFlight; // sectors of the command in flight, a DMA command may get fewer
+   int dmaArea;                  // DMA data area of the command in flight, -1 = none
+   int multiCnt;                 // sectors per DRQ block of READ/WRITE MULTIPLE EXT, 0 = 1
+   long commandsLeft;            // commands not issued yet
+   long commandsDone;            // commands completed without error
+   int errorCode;                // driver error code of the failed command, 0 = none
+   struct ASY_CMD cmdCtx;        // context of the command in flight
+};
+
+// Consumer or producer of one DRQ block of a streamed PIO command (see
+// StreamSectorsInLBA48()), or consumer of one command's data of a pipelined
+// DMA read (see PipelinedReadDMA()). pBlock points to numBytes of data;
+// pContext is passed through from the caller.
+typedef void ( *StreamBlockFn_t )( unsigned char far* pBlock, long numBytes, void* pContext );
+
+// Results of a surface scan (see SurfaceScan())
+struct ScanResult_t {
+   unsigned long lastLBA;        // last LBA scanned (bits 31:0)
+   unsigned long lastLBAHigh;    // last LBA scanned (bits 47:32)
+   unsigned long sectorsScanned; // sectors verified or read (bits 31:0)
+   unsigned long sectorsScannedHigh; // sectors verified or read (bits 47:32)
+   unsigned long badSectors;     // sectors that still failed after bisecting
+   unsigned long slowChunks;     // chunks slower than the slow limit
+   unsigned long retriedChunks;  // failed chunks whose halves all passed
+   unsigned long commands;       // commands issued, bisecting included
+   long ticks;                   // BIOS ticks the scan took
+   int stopped;                  // TRUE = stopped early (see SurfaceScan())
 };
 
 #pragma pack( push, 1 ) 
@@ -181,7 +244,7 @@ extern unsigned long ugReturnValue4;
 extern unsigned long ugReturnValue5;
 
 // Arrarys
-extern unsigned char buffer[BUFFER_SIZE];   // The global data buffer for ATACMD.c
+extern unsigned char far* buffer;          // The global data buffer for ATACMD.c (BUFFER_SIZE bytes)
 extern unsigned char wcMaxLBA[8];           // Holds the max LBA from different ATACMD.c functions
 extern char wcPrintBuffer[NUMBER_OF_CHARACTERS_IN_DOS_LINE+1];   // Allocates memory for ATACMD.c printing
 extern char wcDriveString[3];
@@ -199,6 +262,7 @@ extern unsigned char far* upBufferPtr;
 // Please add in alphabetical order
 extern void ATALIB_CleanUp( void );
 extern void ATALIB_Initialize( void );
+extern int CalibratePIOWidth( void );
 extern void ChangeDriveCapacityViaDCO( unsigned long gNewCapacity );
 extern void ChangeSecuritySupportViaDCO( int kSecurityTurnOn );
 extern void CheckDCOSupported( void );
@@ -213,6 +277,7 @@ extern void CheckSecurityLevel( void );
 extern void CheckSecurityLocked( void );
 extern void CheckSecuritySupported( void );
 extern void CheckStatusAndErrorRegisters( unsigned char expectedStatus, char expectedError );
+extern long ComparePattern( const unsigned char far* pBuffer, unsigned long numBytes, int pattern, unsigned long seed, unsigned long lba );
 extern void DeviceConfigurationIdentify( void );
 extern void DeviceConfigurationRestore( void );
 extern void DisableInterrupt( void );
@@ -221,6 +286,9 @@ extern int DisplayConnectedATAStorageDevices( int numDevices );
 extern int EnableInterrupt( void );
 extern int EnableISADMA( void );
 extern int EnablePCIDMA( void );
+extern void FillDMABuffers( unsigned char fillByte );
+extern void FillPattern( unsigned char far* pBuffer, unsigned long numBytes, int pattern, unsigned long seed, unsigned long lba );
+extern char* FormatLBA48( char* pString, unsigned long lbaHigh, unsigned long lbaLow );
 extern void HandleError( int kErrorFlag );
 extern void IdentifyDevice( void );
 extern struct StorageDevice_t* GetDeviceInfo( unsigned int deviceIndex );
@@ -255,6 +323,8 @@ extern void RemoveHPA( void );
 extern void ReadNativeMaxAddress( int kCommandType );
 extern unsigned int ScanForStorageDevices( void );
 extern void SecureErase( const char* wcPasswordString, int kPasswordType, int kEraseType );
+extern void RunScheduledJobs( struct SchedJob_t* pJobs, unsigned int numJobs );
+extern void SecureEraseStart( struct ASY_CMD* pEraseCmd, const char* wcPasswordString, int kPasswordType, int kEraseType );
 extern void SecuritySetPassword( const char* wcPasswordString, int kPasswordType, int kSecurityLevel );
 extern void SecurityUnlockPassword( const char* wcPasswordString, int kPasswordType );
 extern void SecurityDisablePassword( const char* wcPasswordString, int kPasswordType );
@@ -270,8 +340,13 @@ extern int SendLBA48DMACommand( int cmd, unsigned int feat, unsigned int secCnt,
 extern void SetActiveDevice( unsigned int deviceIndex );
 extern void SetBasePorts( int kSelectBasePort );
 extern void SetHPA( int kCommandType, int kVolatility, unsigned long gLBA );
-extern void SetMaxAddress( int kCommandType, int kVolatility, unsigned long gLBA );
+extern void SetMaxAddress( int kCommandType, int kVolatility, unsigned long gLBA, unsigned long gLBAHigh );
 extern void SoftwareReset( void );
+extern int StreamSectorsInLBA48( unsigned long lba, unsigned long numSectors, StreamBlockFn_t pConsumer, void* pContext );
+extern int StreamSectorsOutLBA48( unsigned long lba, unsigned long numSectors, StreamBlockFn_t pProducer, void* pContext );
+extern int SurfaceScan( unsigned long startLBA, unsigned long startLBAHigh, unsigned long endLBA, unsigned long endLBAHigh, int useDMA, unsigned long slowUs, const char* pMapFileName, struct ScanResult_t* pResult );
+extern int OverwriteJobSetup( unsigned int deviceIndex, struct SchedJob_t* pJob );
+extern int PipelinedReadDMA( unsigned long lba, unsigned long numSectors, unsigned int sectorsPerCmd, StreamBlockFn_t pConsumer, void* pContext );
 extern void WriteDMA( unsigned long gLBA, unsigned long gNumberOfSectors );
 extern void WriteSectors( unsigned int kCylinder, unsigned int kHead, unsigned int kSector, unsigned long gLBA, unsigned long gNumberOfSectors, int kWriteMode );
 extern void WriteSectorsInCHS( unsigned int kCylinder, unsigned int kHead, unsigned int kSector, unsigned long gNumberOfSectors );